@@ -0,0 +1,461 @@
+#include "apu.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "nesMemory.h"
+#include "trace.h"
+
+// https://www.nesdev.org/wiki/APU
+
+static constexpr std::array<uint8_t, 32> LENGTHS = {
+    10, 254, 20, 2,  40, 4,  80, 6,  160, 8,  60, 10, 14, 12, 26, 14,
+    12, 16,  24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30};
+
+static constexpr std::array<uint8_t, 4> DUTIES = {0b01000000, 0b01100000,
+                                                  0b01111000, 0b10011111};
+
+static constexpr std::array<uint16_t, 16> NTSC_NOISE_PERIODS = {
+    4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068};
+static constexpr std::array<uint16_t, 16> PAL_NOISE_PERIODS = {
+    4, 8, 14, 30, 60, 88, 118, 148, 188, 236, 354, 472, 708, 944, 1890, 3778};
+
+static constexpr std::array<uint16_t, 16> NTSC_DMC_PERIODS = {
+    428, 380, 340, 320, 286, 254, 226, 214,
+    190, 160, 142, 128, 106, 84,  72,  54};
+static constexpr std::array<uint16_t, 16> PAL_DMC_PERIODS = {
+    398, 354, 316, 298, 276, 236, 210, 198,
+    176, 148, 132, 118, 98,  78,  66,  50};
+
+// In CPU cycles, the last four step entry also raises the IRQ
+static constexpr std::array<APU::FrameSequence, 2> NTSC_SEQUENCES = {{
+    {{7457, 14913, 22371, 29829, 0}, 29830, 4},
+    {{7457, 14913, 22371, 29829, 37281}, 37282, 5},
+}};
+static constexpr std::array<APU::FrameSequence, 2> PAL_SEQUENCES = {{
+    {{8313, 16627, 24939, 33253, 0}, 33254, 4},
+    {{8313, 16627, 24939, 33253, 41565}, 41566, 5},
+}};
+
+// Non linear mixer, https://www.nesdev.org/wiki/APU_Mixer, scaled so full
+// output is just under 16 bits
+static std::array<int32_t, 31> makePulseTable() {
+  std::array<int32_t, 31> table{};
+  for (size_t n = 1; n < table.size(); ++n) {
+    table[n] = std::lround(95.52 / (8128.0 / n + 100) * 32000);
+  }
+  return table;
+}
+
+static std::array<int32_t, 203> makeTNDTable() {
+  std::array<int32_t, 203> table{};
+  for (size_t n = 1; n < table.size(); ++n) {
+    table[n] = std::lround(163.67 / (24329.0 / n + 100) * 32000);
+  }
+  return table;
+}
+
+static const std::array<int32_t, 31> PULSE_TABLE = makePulseTable();
+static const std::array<int32_t, 203> TND_TABLE = makeTNDTable();
+
+void APU::Envelope::clock() {
+  if (start) {
+    start = false;
+    decay = 15;
+    divider = volume;
+  } else if (divider == 0) {
+    divider = volume;
+    if (decay > 0) {
+      --decay;
+    } else if (loop) {
+      decay = 15;
+    }
+  } else {
+    --divider;
+  }
+}
+
+uint16_t APU::Pulse::sweepTarget() const {
+  uint16_t change = period >> sweepShift;
+  if (!sweepNegate) return period + change;
+  if (change > period) return 0;
+  return period - change - onesComplement;
+}
+
+uint8_t APU::Pulse::output() const {
+  if (length == 0 || muted()) return 0;
+  return ((DUTIES[duty] << step) & 0x80) ? envelope.output() : 0;
+}
+
+void APU::Pulse::clockSweep() {
+  if (sweepDivider == 0 && sweepEnabled && sweepShift > 0 && !muted()) {
+    period = sweepTarget();
+  }
+  if (sweepDivider == 0 || sweepReload) {
+    sweepDivider = sweepPeriod;
+    sweepReload = false;
+  } else {
+    --sweepDivider;
+  }
+}
+
+uint8_t APU::Triangle::output() const {
+  // 15 down to 0 then 0 up to 15
+  return (step < 16) ? 15 - step : step - 16;
+}
+
+APU::APU(NesMemory& memory, const RegionTiming& timing, uint64_t startCycle)
+    : memory(memory),
+      pulses(),
+      triangle(),
+      noise(),
+      dmc(),
+      fiveStep(false),
+      irqInhibit(false),
+      frameIRQ(false),
+      dmcIRQ(false),
+      frameStep(0),
+      sequenceStart(startCycle),
+      synthesis(true),
+      stall(0),
+      time(startCycle),
+      frameStart(startCycle),
+      amplitude(0),
+      blip(timing.masterClock, timing.cpuDivider, SAMPLE_RATE,
+           SAMPLE_RATE / 10) {
+  // Dendy's APU counts like NTSC
+  bool pal = timing.region == Region::PAL;
+  noisePeriods = pal ? PAL_NOISE_PERIODS.data() : NTSC_NOISE_PERIODS.data();
+  dmcPeriods = pal ? PAL_DMC_PERIODS.data() : NTSC_DMC_PERIODS.data();
+  sequences = pal ? PAL_SEQUENCES.data() : NTSC_SEQUENCES.data();
+
+  pulses[0].onesComplement = true;
+  for (Pulse& pulse : pulses) pulse.next = startCycle + 2;
+  triangle.next = startCycle + 1;
+  noise.shift = 0x0001;
+  noise.period = noisePeriods[0];
+  noise.next = startCycle + noise.period;
+  dmc.period = dmcPeriods[0];
+  dmc.bufferEmpty = true;
+  dmc.silence = true;
+  dmc.bitsRemaining = 8;
+  dmc.next = startCycle + dmc.period;
+  frameStepTime = sequenceStart + sequences[0].steps[0];
+}
+
+void APU::catchUp(uint64_t cycle) {
+  TRACE_SCOPE("APU");
+  while (true) {
+    uint64_t next = std::min({frameStepTime, pulses[0].next, pulses[1].next,
+                              triangle.next, noise.next, dmc.next});
+    if (next >= cycle) break;
+    time = next;
+
+    // Frame counter first so silent channels can skip ahead to it
+    if (frameStepTime == time) clockFrameSequencer();
+    uint64_t limit = std::min(cycle, frameStepTime);
+    for (Pulse& pulse : pulses) {
+      if (pulse.next == time) clockPulse(pulse, limit);
+    }
+    if (triangle.next == time) clockTriangle(limit);
+    if (noise.next == time) clockNoise(limit);
+    if (dmc.next == time) clockDMC();
+    mix();
+  }
+  time = cycle;
+}
+
+void APU::endFrame(uint64_t cycle) {
+  catchUp(cycle);
+  if (synthesis) blip.endFrame(cycle - frameStart);
+  frameStart = cycle;
+}
+
+void APU::setSynthesis(bool enabled) {
+  if (enabled == synthesis) return;
+  synthesis = enabled;
+  if (!synthesis) {
+    for (Pulse& pulse : pulses) pulse.next = NEVER;
+    triangle.next = NEVER;
+    noise.next = NEVER;
+    return;
+  }
+  // Timer phases are lost, which can't be heard
+  for (Pulse& pulse : pulses) pulse.next = time + 1;
+  triangle.next = time + 1;
+  noise.next = time + 1;
+  mix();
+}
+
+uint64_t APU::nextFrameIRQ() const {
+  if (fiveStep || irqInhibit || frameIRQ) return NEVER;
+  // Raised on the last step of the four step sequence
+  uint64_t irq = sequenceStart + sequences[0].steps[3];
+  if (irq < frameStepTime) irq += sequences[0].period;
+  return irq + 1;
+}
+
+uint64_t APU::nextDMCFetch() const {
+  // The next byte is fetched when the shift register empties and takes the
+  // buffered one
+  if (dmc.bytesRemaining == 0 || dmc.bufferEmpty) return NEVER;
+  return dmc.next + (dmc.bitsRemaining - 1) * dmc.period + 1;
+}
+
+void APU::write(uint16_t addr, uint8_t val) {
+  switch (addr) {
+    case 0x4000:
+    case 0x4004: {
+      Pulse& pulse = pulses[(addr >> 2) & 0x01];
+      pulse.duty = val >> 6;
+      pulse.envelope.loop = val & 0x20;
+      pulse.envelope.constant = val & 0x10;
+      pulse.envelope.volume = val & 0x0F;
+      break;
+    }
+    case 0x4001:
+    case 0x4005: {
+      Pulse& pulse = pulses[(addr >> 2) & 0x01];
+      pulse.sweepEnabled = val & 0x80;
+      pulse.sweepPeriod = (val >> 4) & 0x07;
+      pulse.sweepNegate = val & 0x08;
+      pulse.sweepShift = val & 0x07;
+      pulse.sweepReload = true;
+      break;
+    }
+    case 0x4002:
+    case 0x4006: {
+      Pulse& pulse = pulses[(addr >> 2) & 0x01];
+      pulse.period = (pulse.period & 0x0700) | val;
+      break;
+    }
+    case 0x4003:
+    case 0x4007: {
+      Pulse& pulse = pulses[(addr >> 2) & 0x01];
+      pulse.period = (pulse.period & 0x00FF) | ((val & 0x07) << 8);
+      if (pulse.enabled) pulse.length = LENGTHS[val >> 3];
+      pulse.step = 0;
+      pulse.envelope.start = true;
+      break;
+    }
+    case 0x4008:
+      triangle.control = val & 0x80;
+      triangle.linearPeriod = val & 0x7F;
+      break;
+    case 0x400A:
+      triangle.period = (triangle.period & 0x0700) | val;
+      break;
+    case 0x400B:
+      triangle.period = (triangle.period & 0x00FF) | ((val & 0x07) << 8);
+      if (triangle.enabled) triangle.length = LENGTHS[val >> 3];
+      triangle.linearReload = true;
+      break;
+    case 0x400C:
+      noise.envelope.loop = val & 0x20;
+      noise.envelope.constant = val & 0x10;
+      noise.envelope.volume = val & 0x0F;
+      break;
+    case 0x400E:
+      noise.mode = val & 0x80;
+      noise.period = noisePeriods[val & 0x0F];
+      break;
+    case 0x400F:
+      if (noise.enabled) noise.length = LENGTHS[val >> 3];
+      noise.envelope.start = true;
+      break;
+    case 0x4010:
+      dmc.irqEnabled = val & 0x80;
+      dmc.loop = val & 0x40;
+      dmc.period = dmcPeriods[val & 0x0F];
+      if (!dmc.irqEnabled) dmcIRQ = false;
+      break;
+    case 0x4011:
+      dmc.level = val & 0x7F;
+      break;
+    case 0x4012:
+      dmc.sampleAddress = 0xC000 | (val << 6);
+      break;
+    case 0x4013:
+      dmc.sampleLength = (val << 4) | 0x0001;
+      break;
+    case 0x4015:
+      for (size_t i = 0; i < pulses.size(); ++i) {
+        pulses[i].enabled = val & (0x01 << i);
+        if (!pulses[i].enabled) pulses[i].length = 0;
+      }
+      triangle.enabled = val & 0x04;
+      if (!triangle.enabled) triangle.length = 0;
+      noise.enabled = val & 0x08;
+      if (!noise.enabled) noise.length = 0;
+      if (val & 0x10) {
+        if (dmc.bytesRemaining == 0) restartSample();
+        fetchSample();
+      } else {
+        dmc.bytesRemaining = 0;
+      }
+      dmcIRQ = false;
+      break;
+    case 0x4017:
+      fiveStep = val & 0x80;
+      irqInhibit = val & 0x40;
+      if (irqInhibit) frameIRQ = false;
+      // The sequence restarts a few cycles after the write
+      frameStep = 0;
+      sequenceStart = time + 3;
+      frameStepTime = sequenceStart + sequences[fiveStep].steps[0];
+      if (fiveStep) {
+        clockQuarterFrame();
+        clockHalfFrame();
+      }
+      break;
+    default:
+      break;
+  }
+  mix();
+}
+
+uint8_t APU::readStatus() {
+  uint8_t status = 0;
+  for (size_t i = 0; i < pulses.size(); ++i) {
+    if (pulses[i].length > 0) status |= 0x01 << i;
+  }
+  if (triangle.length > 0) status |= 0x04;
+  if (noise.length > 0) status |= 0x08;
+  if (dmc.bytesRemaining > 0) status |= 0x10;
+  if (frameIRQ) status |= 0x40;
+  if (dmcIRQ) status |= 0x80;
+  frameIRQ = false;
+  return status;
+}
+
+void APU::clockFrameSequencer() {
+  const FrameSequence& sequence = sequences[fiveStep];
+  if (fiveStep) {
+    // Q, QH, Q, nothing, QH
+    if (frameStep != 3) clockQuarterFrame();
+    if (frameStep == 1 || frameStep == 4) clockHalfFrame();
+  } else {
+    // Q, QH, Q, QH and IRQ
+    clockQuarterFrame();
+    if (frameStep == 1 || frameStep == 3) clockHalfFrame();
+    if (frameStep == 3 && !irqInhibit) frameIRQ = true;
+  }
+
+  if (++frameStep == sequence.count) {
+    frameStep = 0;
+    sequenceStart += sequence.period;
+  }
+  frameStepTime = sequenceStart + sequence.steps[frameStep];
+}
+
+void APU::clockQuarterFrame() {
+  for (Pulse& pulse : pulses) pulse.envelope.clock();
+  noise.envelope.clock();
+
+  if (triangle.linearReload) {
+    triangle.linearCounter = triangle.linearPeriod;
+  } else if (triangle.linearCounter > 0) {
+    --triangle.linearCounter;
+  }
+  if (!triangle.control) triangle.linearReload = false;
+}
+
+void APU::clockHalfFrame() {
+  for (Pulse& pulse : pulses) {
+    if (pulse.length > 0 && !pulse.envelope.loop) --pulse.length;
+    pulse.clockSweep();
+  }
+  if (triangle.length > 0 && !triangle.control) --triangle.length;
+  if (noise.length > 0 && !noise.envelope.loop) --noise.length;
+}
+
+// Silent channels jump every timer event up to limit at once, nothing that
+// could make them audible happens before it
+void APU::clockPulse(Pulse& pulse, uint64_t limit) {
+  uint64_t period = (pulse.period + 1) * 2;
+  uint64_t events = 1;
+  if (pulse.length == 0 || pulse.muted() || pulse.envelope.output() == 0) {
+    events = (limit - time + period - 1) / period;
+  }
+  pulse.step = (pulse.step + events) & 0x07;
+  pulse.next = time + events * period;
+}
+
+void APU::clockTriangle(uint64_t limit) {
+  uint64_t period = triangle.period + 1;
+  if (triangle.running()) {
+    triangle.step = (triangle.step + 1) & 0x1F;
+    triangle.next = time + period;
+  } else {
+    triangle.next = time + (limit - time + period - 1) / period * period;
+  }
+}
+
+void APU::clockNoise(uint64_t limit) {
+  // The shift register isn't clocked while silent, which nothing can observe
+  if (noise.silent()) {
+    noise.next =
+        time + (limit - time + noise.period - 1) / noise.period * noise.period;
+    return;
+  }
+  uint16_t feedback =
+      (noise.shift ^ (noise.shift >> (noise.mode ? 6 : 1))) & 0x01;
+  noise.shift = (noise.shift >> 1) | (feedback << 14);
+  noise.next = time + noise.period;
+}
+
+void APU::clockDMC() {
+  dmc.next = time + dmc.period;
+  if (!dmc.silence) {
+    if (dmc.shift & 0x01) {
+      if (dmc.level <= 125) dmc.level += 2;
+    } else {
+      if (dmc.level >= 2) dmc.level -= 2;
+    }
+  }
+  dmc.shift >>= 1;
+
+  if (--dmc.bitsRemaining > 0) return;
+  dmc.bitsRemaining = 8;
+  dmc.silence = dmc.bufferEmpty;
+  if (!dmc.bufferEmpty) {
+    dmc.shift = dmc.buffer;
+    dmc.bufferEmpty = true;
+    fetchSample();
+  }
+}
+
+// Sample memory is cartridge space, reading it has no side effects. The DMA
+// halts the CPU for 4 cycles, the 1-3 cycle variations with what the CPU was
+// doing aren't modelled
+void APU::fetchSample() {
+  if (!dmc.bufferEmpty || dmc.bytesRemaining == 0) return;
+  stall += 4;
+  dmc.buffer = memory[dmc.address];
+  dmc.bufferEmpty = false;
+  dmc.address = (dmc.address == 0xFFFF) ? 0x8000 : dmc.address + 1;
+  if (--dmc.bytesRemaining == 0) {
+    if (dmc.loop) {
+      restartSample();
+    } else if (dmc.irqEnabled) {
+      dmcIRQ = true;
+    }
+  }
+}
+
+void APU::restartSample() {
+  dmc.address = dmc.sampleAddress;
+  dmc.bytesRemaining = dmc.sampleLength;
+}
+
+void APU::mix() {
+  if (!synthesis) return;
+  int32_t pulse = PULSE_TABLE[pulses[0].output() + pulses[1].output()];
+  int32_t tnd = TND_TABLE[3 * triangle.output() + 2 * noise.output() +
+                          dmc.level];
+  int32_t next = pulse + tnd;
+  if (next != amplitude) {
+    blip.addDelta(time - frameStart, next - amplitude);
+    amplitude = next;
+  }
+}
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "blipBuffer.h"
+#include "region.h"
+
+class NesMemory;
+
+// Two pulse channels, triangle, noise, DMC and the frame counter. Nothing is
+// stepped per cycle: the APU is caught up to the CPU on register access and
+// at deadlines, jumping from one channel timer or frame counter event to the
+// next, and only amplitude changes reach the blip buffer.
+//
+// With synthesis off only what the CPU can observe is kept: length counters,
+// the frame counter and its IRQ, and the DMC's fetches, stalls and IRQ. The
+// waveform timers aren't run and nothing is mixed.
+class APU {
+ public:
+  static constexpr uint32_t SAMPLE_RATE = 48000;
+  static constexpr uint64_t NEVER = UINT64_MAX;
+
+  struct FrameSequence {
+    std::array<uint32_t, 5> steps;  // Cycles from the start of the sequence
+    uint32_t period;
+    int count;
+  };
+
+ private:
+  struct Envelope {
+    bool start;
+    bool loop;  // Also halts the length counter
+    bool constant;
+    uint8_t volume;  // Constant volume or divider period
+    uint8_t divider;
+    uint8_t decay;
+
+    void clock();
+    inline uint8_t output() const { return constant ? volume : decay; }
+  };
+
+  struct Pulse {
+    bool onesComplement;  // Pulse 1 negates with one's complement
+    bool enabled;
+    Envelope envelope;
+    uint8_t duty;
+    uint8_t step;
+    uint16_t period;
+    uint8_t length;
+
+    bool sweepEnabled;
+    bool sweepNegate;
+    bool sweepReload;
+    uint8_t sweepPeriod;
+    uint8_t sweepShift;
+    uint8_t sweepDivider;
+
+    uint64_t next;  // Cycle the timer next runs out
+
+    uint16_t sweepTarget() const;
+    inline bool muted() const {
+      return period < 8 || sweepTarget() > 0x7FF;
+    }
+    uint8_t output() const;
+    void clockSweep();
+  };
+
+  struct Triangle {
+    bool enabled;
+    bool control;  // Also halts the length counter
+    bool linearReload;
+    uint8_t linearPeriod;
+    uint8_t linearCounter;
+    uint8_t step;
+    uint16_t period;
+    uint8_t length;
+
+    uint64_t next;
+
+    // Very short periods are ultrasonic and left frozen
+    inline bool running() const {
+      return linearCounter > 0 && length > 0 && period >= 2;
+    }
+    uint8_t output() const;
+  };
+
+  struct Noise {
+    bool enabled;
+    Envelope envelope;
+    bool mode;
+    uint16_t period;
+    uint16_t shift;
+    uint8_t length;
+
+    uint64_t next;
+
+    inline bool silent() const {
+      return length == 0 || envelope.output() == 0;
+    }
+    inline uint8_t output() const {
+      return (silent() || (shift & 0x01)) ? 0 : envelope.output();
+    }
+  };
+
+  struct DMC {
+    bool irqEnabled;
+    bool loop;
+    uint16_t period;
+    uint8_t level;
+
+    uint16_t sampleAddress;
+    uint16_t sampleLength;
+    uint16_t address;
+    uint16_t bytesRemaining;
+
+    uint8_t buffer;
+    bool bufferEmpty;
+    uint8_t shift;
+    uint8_t bitsRemaining;
+    bool silence;
+
+    uint64_t next;
+  };
+
+  NesMemory& memory;
+  const uint16_t* noisePeriods;
+  const uint16_t* dmcPeriods;
+  const FrameSequence* sequences;  // Four step then five step
+
+  std::array<Pulse, 2> pulses;
+  Triangle triangle;
+  Noise noise;
+  DMC dmc;
+
+  // Frame counter
+  bool fiveStep;
+  bool irqInhibit;
+  bool frameIRQ;
+  bool dmcIRQ;
+  int frameStep;
+  uint64_t sequenceStart;
+  uint64_t frameStepTime;
+
+  bool synthesis;
+  uint64_t stall;  // CPU cycles owed to DMC fetches
+
+  uint64_t time;        // CPU cycle everything has been run up to
+  uint64_t frameStart;  // CPU cycle the blip buffer's frame started on
+  int32_t amplitude;
+
+  BlipBuffer blip;
+
+ public:
+  APU(NesMemory& memory, const RegionTiming& timing, uint64_t startCycle);
+
+  // Runs everything that happens before CPU cycle cycle
+  void catchUp(uint64_t cycle);
+  // Completes audio up to cycle and makes it readable
+  void endFrame(uint64_t cycle);
+  inline size_t samplesAvailable() const { return blip.samplesAvailable(); }
+  inline size_t readSamples(int16_t* out, size_t count) {
+    return blip.readSamples(out, count);
+  }
+  // Small adjustments keep an audio device's buffer from drifting
+  inline void setRateRatio(double ratio) { blip.setRatio(ratio); }
+
+  // Can be flipped at any time, game visible state carries on regardless
+  void setSynthesis(bool enabled);
+  inline bool getSynthesis() const { return synthesis; }
+
+  // Cycles the CPU has to be halted for the DMC's sample fetches since the
+  // last call
+  inline uint64_t takeStall() {
+    uint64_t cycles = stall;
+    stall = 0;
+    return cycles;
+  }
+
+  inline bool getIRQ() const { return frameIRQ || dmcIRQ; }
+  // CPU cycles by which the APU must be caught up for its IRQs to be on
+  // time, NEVER if none are coming. DMC IRQs only come with a sample fetch,
+  // which also stalls the CPU, so every fetch is a deadline
+  uint64_t nextFrameIRQ() const;
+  uint64_t nextDMCFetch() const;
+
+  // $4000-$4013, $4015 and $4017
+  void write(uint16_t addr, uint8_t val);
+  uint8_t readStatus();
+
+ private:
+  void clockFrameSequencer();
+  void clockQuarterFrame();
+  void clockHalfFrame();
+
+  void clockPulse(Pulse& pulse, uint64_t limit);
+  void clockTriangle(uint64_t limit);
+  void clockNoise(uint64_t limit);
+  void clockDMC();
+  void fetchSample();
+  void restartSample();
+
+  void mix();
+};
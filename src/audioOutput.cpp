@@ -0,0 +1,87 @@
+#include "audioOutput.h"
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+#include "utils.h"
+
+AudioOutput::AudioOutput(uint32_t sampleRate)
+    : device(0),
+      sampleRate(sampleRate),
+      targetFill(DEVICE_SAMPLES * 4),
+      lastSample(0),
+      underruns(0),
+      dropped(0) {
+  if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) {
+    warning(("Audio could not be initialized! SDL Error: " +
+             std::string(SDL_GetError()))
+                .c_str());
+    return;
+  }
+
+  SDL_AudioSpec desired{};
+  desired.freq = sampleRate;
+  desired.format = AUDIO_S16SYS;
+  desired.channels = 1;
+  desired.samples = DEVICE_SAMPLES;
+  desired.callback = callback;
+  desired.userdata = this;
+
+  // SDL converts if the device wants something else
+  SDL_AudioSpec obtained;
+  device = SDL_OpenAudioDevice(nullptr, 0, &desired, &obtained, 0);
+  if (device == 0) {
+    warning(("Audio device could not be opened! SDL Error: " +
+             std::string(SDL_GetError()))
+                .c_str());
+    SDL_QuitSubSystem(SDL_INIT_AUDIO);
+    return;
+  }
+
+  // Enough to ride out a late frame without the latency of a large buffer
+  targetFill = std::max<size_t>(targetFill, obtained.samples * 2);
+  std::cout << "Audio: " << SDL_GetCurrentAudioDriver() << ", " << sampleRate
+            << "Hz" << std::endl;
+  SDL_PauseAudioDevice(device, 0);
+}
+
+AudioOutput::~AudioOutput() {
+  if (device == 0) return;
+  SDL_CloseAudioDevice(device);
+  SDL_QuitSubSystem(SDL_INIT_AUDIO);
+}
+
+void AudioOutput::push(const int16_t* samples, size_t count) {
+  if (device == 0) return;
+  dropped += count - ring.push(samples, count);
+}
+
+double AudioOutput::rateRatio() const {
+  if (device == 0) return 1.0;
+  // Below the target more samples are made and above it fewer, the offset is
+  // small enough that the pitch change cannot be heard
+  double fill = static_cast<double>(ring.size());
+  double error = (static_cast<double>(targetFill) - fill) / targetFill;
+  return 1.0 + MAX_RATE_DELTA * std::clamp(error, -1.0, 1.0);
+}
+
+std::chrono::nanoseconds AudioOutput::excess() const {
+  size_t fill = ring.size();
+  if (device == 0 || fill <= targetFill) return std::chrono::nanoseconds(0);
+  return std::chrono::nanoseconds((fill - targetFill) * 1000000000 /
+                                  sampleRate);
+}
+
+void AudioOutput::callback(void* userdata, uint8_t* stream, int length) {
+  AudioOutput& audio = *static_cast<AudioOutput*>(userdata);
+  int16_t* out = reinterpret_cast<int16_t*>(stream);
+  size_t count = length / sizeof(int16_t);
+
+  size_t read = audio.ring.pop(out, count);
+  if (read > 0) audio.lastSample = out[read - 1];
+  if (read < count) {
+    std::fill(out + read, out + count, audio.lastSample);
+    audio.underruns.fetch_add(1, std::memory_order_relaxed);
+  }
+}
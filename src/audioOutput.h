@@ -0,0 +1,56 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "spscQueue.h"
+
+// Plays samples through an SDL audio device. The emulation thread pushes into
+// a lock free ring that the device's callback drains, nothing is ever locked
+// on either side. Works with any SDL driver, including dummy, and quietly
+// does nothing if no device can be opened.
+class AudioOutput {
+ public:
+  static constexpr size_t RING_SIZE = 8192;  // Samples, about 170ms
+  static constexpr uint16_t DEVICE_SAMPLES = 512;
+  // Most the output rate is ever nudged by to keep the ring at its target
+  static constexpr double MAX_RATE_DELTA = 0.005;
+
+ private:
+  SDL_AudioDeviceID device;
+  uint32_t sampleRate;
+  size_t targetFill;  // Ring fill the rate control aims for
+
+  SPSCQueue<int16_t, RING_SIZE> ring;
+  int16_t lastSample;  // Callback only, repeated on underrun to avoid clicks
+  std::atomic<uint64_t> underruns;
+  uint64_t dropped;  // Samples that did not fit in the ring
+
+ public:
+  explicit AudioOutput(uint32_t sampleRate);
+  ~AudioOutput();
+  AudioOutput(const AudioOutput&) = delete;
+  AudioOutput& operator=(const AudioOutput&) = delete;
+
+  inline bool isOpen() const { return device != 0; }
+
+  // Emulation thread
+  void push(const int16_t* samples, size_t count);
+  // Ratio to resample by so the ring drifts back to its target fill
+  double rateRatio() const;
+  // How long until the ring drains back down to its target, emulation can
+  // sleep this off so the audio device paces it
+  std::chrono::nanoseconds excess() const;
+
+  inline uint64_t getUnderruns() const {
+    return underruns.load(std::memory_order_relaxed);
+  }
+  inline uint64_t getDropped() const { return dropped; }
+
+ private:
+  static void callback(void* userdata, uint8_t* stream, int length);
+};
@@ -0,0 +1,157 @@
+#include "audioWriter.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <iostream>
+
+#include "trace.h"
+#include "utils.h"
+
+namespace {
+
+template <size_t N>
+void putLittleEndian(std::array<char, N>& out, size_t offset, uint32_t value,
+                     int bytes) {
+  for (int i = 0; i < bytes; ++i) out[offset + i] = (value >> (i * 8)) & 0xFF;
+}
+
+}  // namespace
+
+AudioWriter::AudioWriter(const std::string& path, Format format,
+                         uint32_t sampleRate)
+    : file(path, std::ios::binary | std::ios::trunc),
+      path(path),
+      format(format),
+      sampleRate(sampleRate),
+      samplesWritten(0),
+      hash(fnv1a(nullptr, 0)),
+      closing(false),
+      failed(false) {
+  if (!file) {
+    error(("Could not create audio file " + path).c_str());
+    return;
+  }
+  // Placeholder sizes until close
+  if (format == Format::WAV) writeHeader(0);
+  block.reserve(BLOCK_SAMPLES);
+  writer = std::thread(&AudioWriter::run, this);
+}
+
+AudioWriter::~AudioWriter() { close(); }
+
+void AudioWriter::write(const int16_t* samples, size_t count) {
+  if (!isOpen()) return;
+  // Hashed as the little endian bytes the file holds, so a golden hash is
+  // the same on every host
+  if constexpr (std::endian::native == std::endian::little) {
+    hash = fnv1a(samples, count * sizeof(int16_t), hash);
+  } else {
+    for (size_t i = 0; i < count; ++i) {
+      uint16_t bits = samples[i];
+      const uint8_t bytes[2] = {static_cast<uint8_t>(bits & 0xFF),
+                                static_cast<uint8_t>(bits >> 8)};
+      hash = fnv1a(bytes, sizeof(bytes), hash);
+    }
+  }
+  samplesWritten += count;
+
+  while (count > 0) {
+    size_t chunk = std::min(count, BLOCK_SAMPLES - block.size());
+    block.insert(block.end(), samples, samples + chunk);
+    samples += chunk;
+    count -= chunk;
+    if (block.size() == BLOCK_SAMPLES) submitBlock();
+  }
+}
+
+void AudioWriter::submitBlock() {
+  std::vector<int16_t> next;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    full.push_back(std::move(block));
+    if (!spare.empty()) {
+      next = std::move(spare.back());
+      spare.pop_back();
+    }
+  }
+  ready.notify_one();
+  // A slow disk only costs memory, never a wait
+  block = std::move(next);
+  block.clear();
+  block.reserve(BLOCK_SAMPLES);
+}
+
+bool AudioWriter::close() {
+  if (!writer.joinable()) return !failed;
+  if (!block.empty()) submitBlock();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    closing = true;
+  }
+  ready.notify_one();
+  writer.join();
+
+  if (format == Format::WAV) {
+    file.seekp(0);
+    writeHeader(static_cast<uint32_t>(samplesWritten * sizeof(int16_t)));
+  }
+  file.close();
+  // The writer thread has finished, failed can be read without the lock
+  if (failed || file.fail()) {
+    failed = true;
+    std::cout << "Failed to Write \"" << path << "\"" << std::endl;
+  }
+  return !failed;
+}
+
+void AudioWriter::writeHeader(uint32_t dataBytes) {
+  std::array<char, 44> header = {'R', 'I', 'F', 'F', 0,   0,   0,   0,
+                                 'W', 'A', 'V', 'E', 'f', 'm', 't', ' '};
+  putLittleEndian(header, 4, 36 + dataBytes, 4);
+  putLittleEndian(header, 16, 16, 4);  // fmt chunk size
+  putLittleEndian(header, 20, 1, 2);   // PCM
+  putLittleEndian(header, 22, 1, 2);   // Mono
+  putLittleEndian(header, 24, sampleRate, 4);
+  putLittleEndian(header, 28, sampleRate * sizeof(int16_t), 4);
+  putLittleEndian(header, 32, sizeof(int16_t), 2);
+  putLittleEndian(header, 34, 16, 2);
+  header[36] = 'd';
+  header[37] = 'a';
+  header[38] = 't';
+  header[39] = 'a';
+  putLittleEndian(header, 40, dataBytes, 4);
+  file.write(header.data(), header.size());
+}
+
+void AudioWriter::run() {
+  TRACE_THREAD("Audio writer");
+  while (true) {
+    std::vector<int16_t> data;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      ready.wait(lock, [this] { return closing || !full.empty(); });
+      if (full.empty()) return;
+      data = std::move(full.front());
+      full.pop_front();
+    }
+
+    if constexpr (std::endian::native == std::endian::big) {
+      for (int16_t& sample : data) {
+        uint16_t bits = sample;
+        sample = static_cast<int16_t>((bits >> 8) | (bits << 8));
+      }
+    }
+    bool written;
+    {
+      TRACE_SCOPE("Audio write");
+      written = !failed &&
+                file.write(reinterpret_cast<const char*>(data.data()),
+                           data.size() * sizeof(int16_t));
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!written) failed = true;
+    spare.push_back(std::move(data));
+  }
+}
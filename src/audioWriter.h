@@ -0,0 +1,67 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Streams mono 16 bit samples to a WAV or raw PCM file. Samples collect in a
+// large block that is handed to a writer thread once full, so emulation only
+// ever takes a lock for the handoff and never waits on the disk.
+class AudioWriter {
+ public:
+  enum class Format {
+    WAV,
+    PCM,  // Headerless, signed 16 bit little endian
+  };
+
+  static constexpr size_t BLOCK_SAMPLES = 1 << 16;  // About 1.4s at 48kHz
+
+ private:
+  std::ofstream file;
+  std::string path;
+  Format format;
+  uint32_t sampleRate;
+
+  std::vector<int16_t> block;  // Being filled by the emulation thread
+  uint64_t samplesWritten;
+  uint64_t hash;  // FNV-1a of the samples' little endian bytes
+
+  // Shared with the writer thread
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::deque<std::vector<int16_t>> full;
+  std::vector<std::vector<int16_t>> spare;  // Written blocks to reuse
+  bool closing;
+  bool failed;  // A write didn't make it to the file, the rest are dropped
+
+  std::thread writer;
+
+ public:
+  AudioWriter(const std::string& path, Format format, uint32_t sampleRate);
+  ~AudioWriter();
+  AudioWriter(const AudioWriter&) = delete;
+  AudioWriter& operator=(const AudioWriter&) = delete;
+
+  // False if the file couldn't be created, everything is then dropped
+  inline bool isOpen() const { return writer.joinable(); }
+
+  void write(const int16_t* samples, size_t count);
+  // Writes everything still buffered and completes the header. False if
+  // anything failed to be written, the file is then incomplete
+  bool close();
+
+  inline uint64_t getSamplesWritten() const { return samplesWritten; }
+  // Same for the same samples whatever the format, for golden comparisons
+  inline uint64_t getHash() const { return hash; }
+
+ private:
+  void submitBlock();
+  void writeHeader(uint32_t dataBytes);
+  void run();
+};
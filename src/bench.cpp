@@ -0,0 +1,493 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "benchRoms.h"
+#include "checks.h"
+#include "console.h"
+#include "cpu.h"
+#include "frame.h"
+#include "nesMemory.h"
+#include "palette.h"
+#include "perfCounters.h"
+#include "ppu.h"
+#include "utils.h"
+
+// Micro and macro benchmarks. Results are printed as a table and written as
+// JSON, and can be compared against an earlier JSON file to flag regressions.
+// --check runs the checks in checks.h instead
+
+namespace {
+
+struct Options {
+  std::string filter;    // Only benchmarks whose name contains this
+  std::string jsonPath;  // Results, stdout if empty
+  std::string baselinePath;
+  double threshold = 5.0;  // Percent slower than the baseline to flag
+  uint64_t frames = 600;   // Per macro benchmark run
+  std::vector<std::string> roms;
+  bool counters = false;  // Host hardware counters alongside the times
+  bool check = false;
+};
+
+struct Result {
+  std::string name;
+  std::string unit;
+  double value;  // Lower is better
+  uint64_t iterations;
+  // Host counters per unit of value, only those that could be read
+  std::vector<std::pair<const char*, double>> counters;
+};
+
+constexpr std::chrono::milliseconds MIN_TIME(200);
+constexpr int REPEATS = 5;
+
+// Keeps results alive so loops aren't optimized away
+volatile uint64_t sink;
+
+double median(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  return values[values.size() / 2];
+}
+
+// Benchmarks not matching the filter are skipped rather than run
+struct Results {
+  std::string filter;
+  std::vector<Result> list;
+  PerfCounters* counters = nullptr;
+
+  bool wants(const std::string& name) const {
+    return name.find(filter) != std::string::npos;
+  }
+
+  void add(const std::string& name, const std::string& unit, double value,
+           uint64_t iterations, const PerfCounters::Counts& counts,
+           double units) {
+    Result result{name, unit, value, iterations, {}};
+    for (int i = 0; counters && i < PerfCounters::NUM_EVENTS; ++i) {
+      if (!counters->has(static_cast<PerfCounters::Event>(i))) continue;
+      result.counters.emplace_back(PerfCounters::NAMES[i], counts[i] / units);
+    }
+    list.push_back(std::move(result));
+  }
+};
+
+void startCounters(Results& results) {
+  if (results.counters) results.counters->start();
+}
+
+void stopCounters(Results& results, PerfCounters::Counts& total) {
+  if (!results.counters) return;
+  PerfCounters::Counts counts = results.counters->stop();
+  for (int i = 0; i < PerfCounters::NUM_EVENTS; ++i) total[i] += counts[i];
+}
+
+// Calls body(n) with n doubling until a call takes MIN_TIME, then records
+// the median nanoseconds per iteration over REPEATS calls of that size.
+// Counters are averaged over all of those calls. n is always a multiple of
+// step, for bodies that can only do whole groups of iterations
+void measure(Results& results, const std::string& name,
+             const std::string& unit,
+             const std::function<void(uint64_t)>& body, uint64_t step = 1) {
+  if (!results.wants(name)) return;
+  using Clock = std::chrono::steady_clock;
+  uint64_t iterations = step;
+  while (true) {
+    auto start = Clock::now();
+    body(iterations);
+    if (Clock::now() - start >= MIN_TIME / REPEATS) break;
+    iterations *= 2;
+  }
+
+  std::vector<double> times;
+  PerfCounters::Counts counts{};
+  for (int i = 0; i < REPEATS; ++i) {
+    startCounters(results);
+    auto start = Clock::now();
+    body(iterations);
+    std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+    stopCounters(results, counts);
+    times.push_back(elapsed.count() / iterations);
+  }
+  results.add(name, unit, median(times), iterations, counts,
+              static_cast<double>(iterations) * REPEATS);
+}
+
+// Bare memory and CPU, nothing else is stepped
+struct Bus {
+  NesMemory memory;
+  PPU ppu;
+  std::unique_ptr<CPU> cpu;
+
+  explicit Bus(std::vector<char> rom) : ppu(nullptr) {
+    loadQuietly(memory, ppu, std::move(rom), "generated");
+    cpu = std::make_unique<CPU>(memory);
+    memory.setCPU(cpu.get());
+  }
+};
+
+void memoryBenchmarks(Results& results) {
+  Bus bus(benchmarkRom());
+  NesMemory& memory = bus.memory;
+
+  measure(results, "memory/read_ram", "ns/op", [&](uint64_t n) {
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < n; ++i) sum += memory.read(i & 0x07FF);
+    sink = sum;
+  });
+  measure(results, "memory/read_rom", "ns/op", [&](uint64_t n) {
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < n; ++i) sum += memory.read(0x8000 | (i & 0x7FFF));
+    sink = sum;
+  });
+  measure(results, "memory/write_ram", "ns/op", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; ++i) memory.write(i & 0x07FF, i);
+  });
+  // PPUSTATUS and the controller, both have side effects
+  measure(results, "memory/read_mmio", "ns/op", [&](uint64_t n) {
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < n; ++i) {
+      sum += memory.read((i & 0x01) ? 0x4016 : 0x2002);
+    }
+    sink = sum;
+  });
+  measure(results, "memory/write_mmio", "ns/op", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; ++i) memory.write(0x2005, i);
+  });
+}
+
+void cpuBenchmarks(Results& results) {
+  struct Mode {
+    const char* name;
+    std::vector<uint8_t> body;
+  };
+  // Operands point into zero page and $0300, all of it RAM
+  const std::vector<Mode> modes = {
+      {"implied", {0xE8}},                      // INX
+      {"accumulator", {0x0A}},                  // ASL
+      {"immediate", {0xA9, 0x42}},              // LDA #$42
+      {"zero_page", {0xA5, 0x10}},              // LDA $10
+      {"zero_page_x", {0xB5, 0x10}},            // LDA $10,X
+      {"absolute", {0xAD, 0x10, 0x03}},         // LDA $0310
+      {"absolute_x", {0xBD, 0x10, 0x03}},       // LDA $0310,X
+      {"absolute_y", {0xB9, 0x10, 0x03}},       // LDA $0310,Y
+      {"indexed_indirect", {0xA1, 0x10}},       // LDA ($10,X)
+      {"indirect_indexed", {0xB1, 0x10}},       // LDA ($10),Y
+      {"store_absolute", {0x8D, 0x10, 0x03}},   // STA $0310
+      {"rmw_zero_page", {0xE6, 0x10}},          // INC $10
+      {"rmw_absolute", {0xEE, 0x10, 0x03}},     // INC $0310
+      {"branch_taken", {0x90, 0x00}},           // BCC to the next
+  };
+
+  for (const Mode& mode : modes) {
+    Bus bus(instructionLoopRom(mode.body));
+    CPU& cpu = *bus.cpu;
+    measure(results, std::string("cpu/") + mode.name, "ns/instruction",
+            [&](uint64_t n) {
+              uint64_t target = cpu.getInstructions() + n;
+              while (cpu.getInstructions() < target) cpu.doCycle();
+            });
+  }
+}
+
+void ppuBenchmarks(Results& results) {
+  Bus bus(benchmarkRom());
+  NesMemory& memory = bus.memory;
+  PPU& ppu = bus.ppu;
+
+  // Palette, nametables and OAM through the registers, as a game would
+  memory.write(0x2006, 0x3F);
+  memory.write(0x2006, 0x00);
+  for (int i = 0; i < 0x20; ++i) memory.write(0x2007, i);
+  memory.write(0x2006, 0x20);
+  memory.write(0x2006, 0x00);
+  for (int i = 0; i < 0x800; ++i) memory.write(0x2007, i);
+  memory.write(0x2003, 0x00);
+  for (int i = 0; i < 0x100; ++i) memory.write(0x2004, i * 7);
+  memory.write(0x2000, 0x08);
+  memory.write(0x2001, 0x1E);
+
+  // Whole frames are run, n counts visible scanlines so vblank is included
+  // in the time per line. n is whole frames of them so every line counted
+  // was run
+  constexpr uint64_t DOTS_PER_SCANLINE = 341;
+  const uint64_t FRAME_CYCLES =
+      (ppu.getTiming().preRenderScanline + 1) * DOTS_PER_SCANLINE;
+
+  // Scrolling every frame means no line can be reused
+  uint8_t scroll = 0;
+  measure(results, "ppu/scanline", "ns/scanline", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i += NESHEIGHT) {
+      (void)memory.read(0x2002);
+      memory.write(0x2005, ++scroll);
+      memory.write(0x2005, scroll);
+      ppu.catchUp(ppu.getCycles() + FRAME_CYCLES);
+    }
+  }, NESHEIGHT);
+  measure(results, "ppu/scanline_reused", "ns/scanline", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i += NESHEIGHT) {
+      ppu.catchUp(ppu.getCycles() + FRAME_CYCLES);
+    }
+  }, NESHEIGHT);
+
+  Palette palette(SDL_PIXELFORMAT_ARGB8888);
+  std::vector<uint32_t> pixels(NESWIDTH * NESHEIGHT);
+  const Frame& frame = ppu.getFrame();
+  measure(results, "frame/convert", "ns/frame", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; ++i) {
+      palette.convert(frame, pixels.data(), NESWIDTH * sizeof(uint32_t));
+    }
+    sink = pixels[n % pixels.size()];
+  });
+  // Presenting needs a display, so it isn't measured here
+}
+
+// A full console run the same way main's headless mode runs it with no
+// movie or recording, reloaded for every repeat so each one does exactly the
+// same work. Only emulation is timed, not loading
+void macroBenchmark(Results& results, const std::string& name,
+                    const std::vector<char>& rom, uint64_t frames) {
+  if (!results.wants("macro/" + name)) return;
+  std::vector<double> times;
+  PerfCounters::Counts counts{};
+  uint64_t instructions = 0;
+  for (int repeat = 0; repeat < REPEATS; ++repeat) {
+    Console console(nullptr);
+    if (!loadQuietly(console, rom, name)) return;
+    console.getAPU().setSynthesis(false);
+
+    startCounters(results);
+    auto start = std::chrono::steady_clock::now();
+    console.attachScheduler();
+    while (console.getPPU().getFrameCount() < frames) console.runFrame();
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+    stopCounters(results, counts);
+    times.push_back(elapsed.count() / frames);
+    instructions = console.getCPU().getInstructions();
+  }
+
+  // Every repeat runs the same instructions
+  double perFrame = median(times);
+  double perInstruction =
+      perFrame * frames / std::max<uint64_t>(instructions, 1);
+  results.add("macro/" + name, "ns/frame", perFrame, frames, counts,
+              static_cast<double>(frames) * REPEATS);
+  results.add("macro/" + name + "/instruction", "ns/instruction",
+              perInstruction, instructions, counts,
+              static_cast<double>(std::max<uint64_t>(instructions, 1)) *
+                  REPEATS);
+}
+
+bool readFile(const std::string& path, std::vector<char>& data) {
+  std::ifstream file(path, std::ifstream::binary);
+  if (file.fail()) return false;
+  data.assign(std::istreambuf_iterator<char>(file),
+              std::istreambuf_iterator<char>());
+  return true;
+}
+
+std::string baseName(const std::string& path) {
+  size_t slash = path.find_last_of("/\\");
+  std::string name = path.substr(slash == std::string::npos ? 0 : slash + 1);
+  size_t dot = name.rfind('.');
+  return dot == std::string::npos ? name : name.substr(0, dot);
+}
+
+void writeJSON(std::ostream& out, const std::vector<Result>& results) {
+  out << std::fixed << std::setprecision(3) << "{\n  \"benchmarks\": [\n";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& result = results[i];
+    out << "    {\"name\": \"" << result.name << "\", \"unit\": \""
+        << result.unit << "\", \"value\": " << result.value
+        << ", \"iterations\": " << result.iterations;
+    if (!result.counters.empty()) {
+      out << ", \"counters\": {";
+      for (size_t j = 0; j < result.counters.size(); ++j) {
+        out << (j > 0 ? ", " : "") << "\"" << result.counters[j].first
+            << "\": " << result.counters[j].second;
+      }
+      out << "}";
+    }
+    out << "}" << (i + 1 < results.size() ? ",\n" : "\n");
+  }
+  out << "  ]\n}\n";
+}
+
+// Only has to read what writeJSON writes, one benchmark per line
+bool readBaseline(const std::string& path, std::vector<Result>& baseline) {
+  std::ifstream file(path);
+  if (file.fail()) {
+    std::cerr << "Failed to Open \"" << path << "\"" << std::endl;
+    return false;
+  }
+  auto field = [](const std::string& line, const std::string& key) {
+    size_t start = line.find("\"" + key + "\": ");
+    if (start == std::string::npos) return std::string();
+    start += key.size() + 4;
+    if (line[start] == '"') {
+      ++start;
+      return line.substr(start, line.find('"', start) - start);
+    }
+    return line.substr(start, line.find_first_of(",}", start) - start);
+  };
+  std::string line;
+  while (std::getline(file, line)) {
+    std::string name = field(line, "name");
+    std::string value = field(line, "value");
+    if (name.empty() || value.empty()) continue;
+    // stod throws on anything that isn't a number
+    try {
+      baseline.push_back(
+          {name, field(line, "unit"), std::stod(value), 0, {}});
+    } catch (const std::logic_error&) {
+      std::cerr << "\"" << path << "\" is not a valid baseline" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+void printUsage(const char* program) {
+  std::cerr << "Usage: " << program << " [options]\n"
+            << "  --filter <text>    Only run benchmarks containing text\n"
+            << "  --json <path>      Write results here, default stdout\n"
+            << "  --baseline <path>  Compare with an earlier --json\n"
+            << "  --threshold <pct>  Slowdown that counts as a "
+               "regression, default 5\n"
+            << "  --frames <n>       Frames per macro run, default 600\n"
+            << "  --rom <path>       Add a macro benchmark, repeatable\n"
+            << "  --counters         Read host hardware counters too\n"
+            << "  --check            Compare the ways of stepping the core "
+               "instead\n";
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+  // stod and stoull throw on anything that isn't a number
+  try {
+    for (int i = 1; i < argc; ++i) {
+      std::string arg = argv[i];
+      bool hasValue = i + 1 < argc;
+      if (arg == "--filter" && hasValue) {
+        options.filter = argv[++i];
+      } else if (arg == "--json" && hasValue) {
+        options.jsonPath = argv[++i];
+      } else if (arg == "--baseline" && hasValue) {
+        options.baselinePath = argv[++i];
+      } else if (arg == "--threshold" && hasValue) {
+        options.threshold = std::stod(argv[++i]);
+      } else if (arg == "--frames" && hasValue) {
+        options.frames = std::stoull(argv[++i]);
+      } else if (arg == "--rom" && hasValue) {
+        options.roms.push_back(argv[++i]);
+      } else if (arg == "--counters") {
+        options.counters = true;
+      } else if (arg == "--check") {
+        options.check = true;
+      } else {
+        printUsage(argv[0]);
+        return false;
+      }
+    }
+  } catch (const std::logic_error&) {
+    printUsage(argv[0]);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!parseOptions(argc, argv, options)) return 1;
+  if (options.check) return runChecks() ? 0 : 1;
+
+  Results results;
+  results.filter = options.filter;
+  // Benchmarks still run without counters when the host won't give them
+  std::unique_ptr<PerfCounters> counters;
+  if (options.counters) {
+    counters = std::make_unique<PerfCounters>();
+    if (!counters->getUnavailable().empty()) {
+      warning(("Hardware counters unavailable, " +
+               counters->getUnavailable())
+                  .c_str());
+    }
+    if (counters->any()) results.counters = counters.get();
+  }
+  memoryBenchmarks(results);
+  cpuBenchmarks(results);
+  ppuBenchmarks(results);
+
+  macroBenchmark(results, "bench_rom", benchmarkRom(), options.frames);
+  // nestest and any other ROMs given, skipped if they aren't there. ROMs
+  // aren't in the repository, so nestest is only run where one was put in
+  std::vector<std::string> roms = {NES_SOURCE_ROOT "/roms/nestest.nes"};
+  roms.insert(roms.end(), options.roms.begin(), options.roms.end());
+  for (const std::string& path : roms) {
+    std::vector<char> rom;
+    if (!readFile(path, rom)) {
+      std::cerr << "Skipping \"" << path << "\", could not be read"
+                << std::endl;
+      continue;
+    }
+    macroBenchmark(results, baseName(path), rom, options.frames);
+  }
+
+  std::vector<Result> baseline;
+  if (!options.baselinePath.empty() &&
+      !readBaseline(options.baselinePath, baseline)) {
+    return 1;
+  }
+
+  // Table on stderr so stdout can carry the JSON
+  int regressions = 0;
+  for (const Result& result : results.list) {
+    std::cerr << std::left << std::setw(36) << result.name << std::right
+              << std::setw(12) << std::fixed << std::setprecision(2)
+              << result.value << " " << result.unit;
+    auto match = std::find_if(
+        baseline.begin(), baseline.end(),
+        [&](const Result& old) { return old.name == result.name; });
+    if (match != baseline.end() && match->value > 0) {
+      double change = (result.value / match->value - 1.0) * 100.0;
+      bool regressed = change > options.threshold;
+      regressions += regressed;
+      std::cerr << "  " << std::showpos << change << std::noshowpos << "%"
+                << (regressed ? "  REGRESSION" : "");
+    }
+    std::cerr << std::endl;
+    if (result.counters.empty()) continue;
+    std::cerr << "    per " << result.unit.substr(result.unit.find('/') + 1)
+              << ":";
+    for (const auto& [counter, value] : result.counters) {
+      std::cerr << " " << counter << " " << value;
+    }
+    std::cerr << std::endl;
+  }
+
+  if (options.jsonPath.empty()) {
+    writeJSON(std::cout, results.list);
+  } else {
+    std::ofstream file(options.jsonPath);
+    writeJSON(file, results.list);
+  }
+
+  if (regressions > 0) {
+    std::cerr << regressions << " regression(s) beyond " << options.threshold
+              << "%" << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,224 @@
+#include "benchRoms.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+#include "console.h"
+#include "nesMemory.h"
+#include "ppu.h"
+
+namespace {
+
+constexpr size_t HEADER_SIZE = 16;
+constexpr size_t PROGRAM_SIZE = 0x4000;
+constexpr size_t CHARACTER_SIZE = 0x2000;
+
+// NROM-128 with vertical mirroring, program mirrored at $8000 and $C000.
+// Other regions than NTSC get an NES 2.0 header to say which
+std::vector<char> nrom(const std::vector<uint8_t>& program, uint16_t reset,
+                       uint16_t nmi, uint16_t irq, Region region) {
+  std::vector<char> rom(HEADER_SIZE + PROGRAM_SIZE + CHARACTER_SIZE, 0);
+  const char header[8] = {'N', 'E', 'S', 0x1A, 1, 1, 0x01, 0x00};
+  memcpy(rom.data(), header, sizeof(header));
+  if (region == Region::PAL) {
+    rom[7] |= 0x08;
+    rom[12] = 1;
+  } else if (region == Region::Dendy) {
+    rom[7] |= 0x08;
+    rom[12] = 3;
+  }
+
+  char* prg = rom.data() + HEADER_SIZE;
+  memcpy(prg, program.data(), std::min(program.size(), PROGRAM_SIZE - 6));
+  const uint16_t vectors[3] = {nmi, reset, irq};
+  for (int i = 0; i < 3; ++i) {
+    prg[PROGRAM_SIZE - 6 + i * 2] = vectors[i] & 0xFF;
+    prg[PROGRAM_SIZE - 5 + i * 2] = vectors[i] >> 8;
+  }
+
+  // Noise for tiles so every line has something to draw
+  uint32_t state = 0x2545F491;
+  char* chr = prg + PROGRAM_SIZE;
+  for (size_t i = 0; i < CHARACTER_SIZE; ++i) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    chr[i] = state & 0xFF;
+  }
+  return rom;
+}
+
+}  // namespace
+
+std::vector<char> benchmarkRom(Region region) {
+  const std::vector<uint8_t> program = {
+      // reset: $8000
+      0x78,               // SEI
+      0xD8,               // CLD
+      0xA2, 0xFF,         // LDX #$FF
+      0x9A,               // TXS
+      0xA9, 0x40,         // LDA #$40
+      0x8D, 0x17, 0x40,   // STA $4017
+      0xA9, 0x00,         // LDA #0
+      0x8D, 0x00, 0x20,   // STA $2000
+      0x8D, 0x01, 0x20,   // STA $2001
+      // vblank1: $8012
+      0x2C, 0x02, 0x20,   // BIT $2002
+      0x10, 0xFB,         // BPL vblank1
+      // vblank2: $8017
+      0x2C, 0x02, 0x20,   // BIT $2002
+      0x10, 0xFB,         // BPL vblank2
+      0xA9, 0x3F,         // LDA #$3F
+      0x8D, 0x06, 0x20,   // STA $2006
+      0xA9, 0x00,         // LDA #$00
+      0x8D, 0x06, 0x20,   // STA $2006
+      0xA2, 0x00,         // LDX #0
+      // palette: $8028
+      0x8A,               // TXA
+      0x8D, 0x07, 0x20,   // STA $2007
+      0xE8,               // INX
+      0xE0, 0x20,         // CPX #32
+      0xD0, 0xF7,         // BNE palette
+      0xA9, 0x20,         // LDA #$20
+      0x8D, 0x06, 0x20,   // STA $2006
+      0xA9, 0x00,         // LDA #$00
+      0x8D, 0x06, 0x20,   // STA $2006
+      0xA0, 0x08,         // LDY #8
+      0xA2, 0x00,         // LDX #0
+      // nametables: $803F
+      0x8E, 0x07, 0x20,   // STX $2007
+      0xE8,               // INX
+      0xD0, 0xFA,         // BNE nametables
+      0x88,               // DEY
+      0xD0, 0xF7,         // BNE nametables
+      0xA2, 0x00,         // LDX #0
+      // sprites: $804A
+      0x8A,               // TXA
+      0x9D, 0x00, 0x02,   // STA $0200,X
+      0xE8,               // INX
+      0xD0, 0xF9,         // BNE sprites
+      0xA9, 0x0F,         // LDA #$0F
+      0x8D, 0x15, 0x40,   // STA $4015
+      0xA9, 0xBF,         // LDA #$BF
+      0x8D, 0x00, 0x40,   // STA $4000
+      0xA9, 0x9F,         // LDA #$9F
+      0x8D, 0x04, 0x40,   // STA $4004
+      0xA9, 0xFF,         // LDA #$FF
+      0x8D, 0x08, 0x40,   // STA $4008
+      0xA9, 0x3F,         // LDA #$3F
+      0x8D, 0x0C, 0x40,   // STA $400C
+      0xA9, 0x08,         // LDA #$08
+      0x8D, 0x03, 0x40,   // STA $4003
+      0x8D, 0x07, 0x40,   // STA $4007
+      0x8D, 0x0B, 0x40,   // STA $400B
+      0x8D, 0x0F, 0x40,   // STA $400F
+      0xA9, 0x88,         // LDA #$88
+      0x8D, 0x00, 0x20,   // STA $2000
+      0xA9, 0x1E,         // LDA #$1E
+      0x8D, 0x01, 0x20,   // STA $2001
+      // main: $8082
+      0xA5, 0x00,         // LDA $00
+      0x65, 0x01,         // ADC $01
+      0x85, 0x01,         // STA $01
+      0x2A,               // ROL
+      0x9D, 0x00, 0x03,   // STA $0300,X
+      0xE8,               // INX
+      0x4C, 0x82, 0x80,   // JMP main
+      // nmi: $8090
+      0x48,               // PHA
+      0xE6, 0x10,         // INC $10
+      0xA5, 0x10,         // LDA $10
+      0x8D, 0x05, 0x20,   // STA $2005
+      0x4A,               // LSR
+      0x8D, 0x05, 0x20,   // STA $2005
+      0x8D, 0x02, 0x40,   // STA $4002
+      0x0A,               // ASL
+      0x8D, 0x06, 0x40,   // STA $4006
+      0x8D, 0x0A, 0x40,   // STA $400A
+      0x8D, 0x0E, 0x40,   // STA $400E
+      0xA9, 0x01,         // LDA #$01
+      0x8D, 0x16, 0x40,   // STA $4016
+      0xA9, 0x00,         // LDA #$00
+      0x8D, 0x16, 0x40,   // STA $4016
+      0xA2, 0x08,         // LDX #8
+      // controller: $80B5
+      0xAD, 0x16, 0x40,   // LDA $4016
+      0xCA,               // DEX
+      0xD0, 0xFA,         // BNE controller
+      0xA9, 0x02,         // LDA #$02
+      0x8D, 0x14, 0x40,   // STA $4014
+      0x68,               // PLA
+      0x40,               // RTI
+  };
+  return nrom(program, 0x8000, 0x8090, 0x8000, region);
+}
+
+std::vector<char> instructionLoopRom(const std::vector<uint8_t>& body) {
+  std::vector<uint8_t> program;
+  while (program.size() + body.size() + 3 <= PROGRAM_SIZE - 6) {
+    program.insert(program.end(), body.begin(), body.end());
+  }
+  // JMP $8000
+  program.insert(program.end(), {0x4C, 0x00, 0x80});
+  return nrom(program, 0x8000, 0x8000, 0x8000, Region::NTSC);
+}
+
+std::vector<char> interruptRom(Region region) {
+  const std::vector<uint8_t> program = {
+      // reset: $8000
+      0x78,               // SEI
+      0xD8,               // CLD
+      0xA2, 0xFF,         // LDX #$FF
+      0x9A,               // TXS
+      0xA9, 0x80,         // LDA #$80
+      0x8D, 0x00, 0x20,   // STA $2000
+      0xA9, 0x1E,         // LDA #$1E
+      0x8D, 0x01, 0x20,   // STA $2001
+      0xA9, 0x00,         // LDA #$00
+      0x8D, 0x17, 0x40,   // STA $4017
+      0xA9, 0x8F,         // LDA #$8F
+      0x8D, 0x10, 0x40,   // STA $4010
+      0xA9, 0x00,         // LDA #$00
+      0x8D, 0x12, 0x40,   // STA $4012
+      0xA9, 0x01,         // LDA #$01
+      0x8D, 0x13, 0x40,   // STA $4013
+      0xA9, 0x10,         // LDA #$10
+      0x8D, 0x15, 0x40,   // STA $4015
+      0x58,               // CLI
+      // loop: $8029
+      0xE6, 0x00,         // INC $00
+      0xAD, 0x02, 0x20,   // LDA $2002
+      0x4C, 0x29, 0x80,   // JMP loop
+      // irq: $8031
+      0x48,               // PHA
+      0xAD, 0x15, 0x40,   // LDA $4015
+      0xE6, 0x02,         // INC $02
+      0x85, 0x04,         // STA $04
+      0xA9, 0x10,         // LDA #$10
+      0x8D, 0x15, 0x40,   // STA $4015
+      0x68,               // PLA
+      0x40,               // RTI
+      // nmi: $8040
+      0xE6, 0x03,         // INC $03
+      0x40,               // RTI
+  };
+  return nrom(program, 0x8000, 0x8040, 0x8031, region);
+}
+
+bool loadQuietly(NesMemory& memory, PPU& ppu, std::vector<char> rom,
+                 const std::string& name) {
+  std::streambuf* out = std::cout.rdbuf(nullptr);
+  bool loaded = memory.loadRom(std::move(rom), name, ppu);
+  std::cout.rdbuf(out);
+  return loaded;
+}
+
+bool loadQuietly(Console& console, std::vector<char> rom,
+                 const std::string& name) {
+  std::streambuf* out = std::cout.rdbuf(nullptr);
+  bool loaded = console.loadRom(std::move(rom), name);
+  std::cout.rdbuf(out);
+  return loaded;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "region.h"
+
+class Console;
+class NesMemory;
+class PPU;
+
+// iNES images built in code so benchmarks don't depend on ROM files. Those
+// taking a region give it in the header
+
+// Initializes the PPU, then scrolls the background, reads the controller,
+// does an OAM DMA and retunes all four tone channels every NMI while the main
+// loop runs a mix of loads, stores and arithmetic. Nothing is ever skipped
+// as unchanged.
+std::vector<char> benchmarkRom(Region region = Region::NTSC);
+
+// body repeated to fill the program space, then a jump back to the start.
+// Interrupts land on the start too
+std::vector<char> instructionLoopRom(const std::vector<uint8_t>& body);
+
+// NMI, the APU frame IRQ and DMC IRQs all on, the DMC sample restarted from
+// every IRQ, while the main loop polls $2002. Interrupt and DMA timing is
+// all there is to it
+std::vector<char> interruptRom(Region region = Region::NTSC);
+
+// Loading prints the header, which would drown out the results
+bool loadQuietly(NesMemory& memory, PPU& ppu, std::vector<char> rom,
+                 const std::string& name);
+bool loadQuietly(Console& console, std::vector<char> rom,
+                 const std::string& name);
@@ -0,0 +1,83 @@
+#include "blipBuffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Windowed sinc impulses for every phase, each summing to exactly
+// 1 << KERNEL_BITS so a step always settles on the right level
+static std::array<std::array<int32_t, BlipBuffer::WIDTH>, BlipBuffer::PHASES>
+makeKernel() {
+  constexpr double PI = 3.14159265358979323846;
+  constexpr double CUTOFF = 0.9;  // Of Nyquist, leaves room for the window
+  constexpr int HALF = BlipBuffer::WIDTH / 2;
+
+  std::array<std::array<int32_t, BlipBuffer::WIDTH>, BlipBuffer::PHASES>
+      table{};
+  for (int phase = 0; phase < BlipBuffer::PHASES; ++phase) {
+    double fraction = static_cast<double>(phase) / BlipBuffer::PHASES;
+    std::array<double, BlipBuffer::WIDTH> taps;
+    double sum = 0;
+    for (int i = 0; i < BlipBuffer::WIDTH; ++i) {
+      double x = i - HALF + 1 - fraction;
+      double sinc = x == 0 ? 1 : std::sin(PI * CUTOFF * x) / (PI * CUTOFF * x);
+      double w = (x + HALF) / BlipBuffer::WIDTH;  // 0-1 across the kernel
+      double window =
+          0.42 - 0.5 * std::cos(2 * PI * w) + 0.08 * std::cos(4 * PI * w);
+      taps[i] = sinc * window;
+      sum += taps[i];
+    }
+
+    int32_t total = 0;
+    for (int i = 0; i < BlipBuffer::WIDTH; ++i) {
+      table[phase][i] =
+          std::lround(taps[i] / sum * (1 << BlipBuffer::KERNEL_BITS));
+      total += table[phase][i];
+    }
+    table[phase][HALF] += (1 << BlipBuffer::KERNEL_BITS) - total;
+  }
+  return table;
+}
+
+const std::array<std::array<int32_t, BlipBuffer::WIDTH>, BlipBuffer::PHASES>
+    BlipBuffer::kernel = makeKernel();
+
+BlipBuffer::BlipBuffer(uint64_t clockNumerator, uint64_t clockDenominator,
+                       uint32_t sampleRate, size_t capacity)
+    : baseFactor((static_cast<uint64_t>(sampleRate) << FRAC_BITS) *
+                 clockDenominator / clockNumerator),
+      factor(baseFactor),
+      offset(0),
+      buffer(capacity * 2 + WIDTH, 0),
+      capacity(capacity),
+      available(0),
+      integrator(0),
+      highPass(0) {}
+
+void BlipBuffer::endFrame(uint64_t time) {
+  offset += time * factor;
+  available = std::min<size_t>(offset >> FRAC_BITS, buffer.size() - WIDTH);
+  if (available > capacity) readSamples(nullptr, available - capacity);
+}
+
+size_t BlipBuffer::readSamples(int16_t* out, size_t count) {
+  count = std::min(count, available);
+  for (size_t i = 0; i < count; ++i) {
+    integrator += buffer[i];
+    // Kept at kernel precision so the filter settles all the way to zero
+    highPass += (integrator - highPass) >> 9;
+    if (out) {
+      int64_t sample = (integrator - highPass) >> KERNEL_BITS;
+      out[i] = std::clamp<int64_t>(sample, INT16_MIN, INT16_MAX);
+    }
+  }
+
+  // Shift out what was read, the kernel tails of later samples stay
+  size_t remaining = (offset >> FRAC_BITS) - count + WIDTH;
+  remaining = std::min(remaining, buffer.size() - count);
+  memmove(buffer.data(), buffer.data() + count, remaining * sizeof(int64_t));
+  std::fill(buffer.begin() + remaining, buffer.end(), 0);
+  offset -= static_cast<uint64_t>(count) << FRAC_BITS;
+  available -= count;
+  return count;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Band limited synthesis. A source only reports when its amplitude changes,
+// each change is added as a band limited step so output at the sample rate
+// costs nothing per input clock. Based on the blip buffer technique.
+class BlipBuffer {
+ public:
+  static constexpr int PHASE_BITS = 5;
+  static constexpr int PHASES = 1 << PHASE_BITS;
+  static constexpr int WIDTH = 16;  // Kernel taps
+  static constexpr int KERNEL_BITS = 15;
+
+ private:
+  static constexpr int FRAC_BITS = 32;
+
+  uint64_t baseFactor;  // Samples per clock, FRAC_BITS fixed point
+  uint64_t factor;      // baseFactor with the rate adjustment applied
+  uint64_t offset;  // Start of the current frame in samples, fixed point
+
+  std::vector<int64_t> buffer;  // Deltas, integrated when read
+  size_t capacity;              // Oldest samples are dropped beyond this
+  size_t available;
+  int64_t integrator;
+  int64_t highPass;  // Tracks DC so it can be removed
+
+  static const std::array<std::array<int32_t, WIDTH>, PHASES> kernel;
+
+ public:
+  // clockRate = clockNumerator / clockDenominator Hz, kept as a fraction so
+  // master clock divisions are exact
+  BlipBuffer(uint64_t clockNumerator, uint64_t clockDenominator,
+             uint32_t sampleRate, size_t capacity);
+
+  // Scales the output rate, e.g. 1.001 makes 0.1% more samples. Takes effect
+  // from the next endFrame
+  inline void setRatio(double ratio) {
+    factor = static_cast<uint64_t>(baseFactor * ratio);
+  }
+
+  // time is in clocks since the last endFrame
+  inline void addDelta(uint64_t time, int32_t delta) {
+    uint64_t position = offset + time * factor;
+    size_t index = position >> FRAC_BITS;
+    if (index + WIDTH > buffer.size()) return;  // Frame far too long
+    const std::array<int32_t, WIDTH>& taps =
+        kernel[(position >> (FRAC_BITS - PHASE_BITS)) & (PHASES - 1)];
+    int64_t* out = buffer.data() + index;
+    for (int i = 0; i < WIDTH; ++i) {
+      out[i] += static_cast<int64_t>(taps[i]) * delta;
+    }
+  }
+
+  // Samples before time are complete and can be read
+  void endFrame(uint64_t time);
+
+  inline size_t samplesAvailable() const { return available; }
+  // out may be nullptr to discard
+  size_t readSamples(int16_t* out, size_t count);
+};
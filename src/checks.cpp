@@ -0,0 +1,264 @@
+#include "checks.h"
+
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "apu.h"
+#include "benchRoms.h"
+#include "console.h"
+#include "cpu.h"
+#include "frame.h"
+#include "input.h"
+#include "nesMemory.h"
+#include "ppu.h"
+#include "region.h"
+#include "scheduler.h"
+#include "utils.h"
+
+namespace {
+
+constexpr uint64_t FRAMES = 300;
+constexpr int APU_STEPS = 20000;
+
+enum class Stepping {
+  LOCKSTEP,   // Everything caught up after every CPU cycle, the reference
+  EVENTS,     // PPU caught up only at its predicted events and on access
+  SCHEDULED,  // Console::runFrame, which the emulator runs
+  NUM_STEPPINGS,
+};
+
+constexpr std::array<const char*, static_cast<int>(Stepping::NUM_STEPPINGS)>
+    STEPPING_NAMES = {"lockstep", "events", "scheduled"};
+
+// What the game and the screen show at the end of a frame
+struct FrameState {
+  uint64_t cycle;
+  uint64_t instructions;
+  uint64_t ramHash;
+  uint64_t frameHash;
+
+  bool operator==(const FrameState&) const = default;
+};
+
+std::vector<FrameState> run(const std::vector<char>& rom, Region region,
+                            Stepping stepping) {
+  std::vector<FrameState> states;
+  Console console(nullptr);
+  if (!loadQuietly(console, rom, "generated")) return states;
+  NesMemory& memory = console.getMemory();
+  PPU& ppu = console.getPPU();
+  CPU& cpu = console.getCPU();
+  APU& apu = console.getAPU();
+  if (ppu.getRegion() != region) return states;
+
+  // Lockstep only uses its own for converting between the clocks, with none
+  // attached register accesses don't catch anything up
+  Scheduler clock(cpu.getCycle(), ppu.getTiming());
+  if (stepping == Stepping::LOCKSTEP) {
+    memory.syncAPU();
+  } else {
+    console.attachScheduler();
+  }
+  // As a headless run without recording has it, what the CPU sees must not
+  // depend on it
+  if (stepping == Stepping::SCHEDULED) apu.setSynthesis(false);
+  Scheduler& scheduler =
+      stepping == Stepping::LOCKSTEP ? clock : console.getScheduler();
+
+  std::vector<int16_t> samples(APU::SAMPLE_RATE / 10);
+  while (ppu.getFrameCount() < FRAMES) {
+    uint64_t frame = ppu.getFrameCount();
+    switch (stepping) {
+      case Stepping::LOCKSTEP:
+        while (ppu.getFrameCount() == frame) {
+          cpu.doCycle();
+          memory.syncAPU();
+          ppu.catchUp(scheduler.ppuCycles(scheduler.cpuTime(cpu.getCycle())));
+          if (ppu.takeNMI()) cpu.setNMI(true);
+        }
+        apu.endFrame(cpu.getCycle());
+        break;
+      case Stepping::EVENTS:
+        while (ppu.getFrameCount() == frame) {
+          // A DMC stall can carry the CPU past a deadline, which has to be
+          // dispatched before the CPU goes on
+          if (cpu.getCycle() < scheduler.getCPUDeadline()) cpu.doCycle();
+          scheduler.dispatch(scheduler.cpuTime(cpu.getCycle()));
+        }
+        apu.endFrame(cpu.getCycle());
+        break;
+      case Stepping::SCHEDULED:
+        console.runFrame();
+        break;
+      default:
+        break;
+    }
+    apu.readSamples(samples.data(), samples.size());
+
+    const std::array<uint8_t, 0x800>& ram = memory.getRAM();
+    const Frame& pixels = ppu.getFrame();
+    states.push_back(
+        {cpu.getCycle(), cpu.getInstructions(), fnv1a(ram.data(), ram.size()),
+         fnv1a(pixels.pixels.data(), pixels.pixels.size())});
+  }
+  return states;
+}
+
+bool compare(const std::string& name, const std::vector<FrameState>& expected,
+             const std::vector<FrameState>& actual) {
+  for (size_t i = 0; i < expected.size(); ++i) {
+    if (i < actual.size() && actual[i] == expected[i]) continue;
+    std::cerr << name << ": differs from lockstep at frame " << i + 1;
+    if (i < actual.size()) {
+      std::cerr << ", CPU cycle " << actual[i].cycle << " not "
+                << expected[i].cycle << ", instructions "
+                << actual[i].instructions << " not "
+                << expected[i].instructions << std::hex << ", RAM hash "
+                << actual[i].ramHash << " not " << expected[i].ramHash
+                << ", frame hash " << actual[i].frameHash << " not "
+                << expected[i].frameHash << std::dec;
+    }
+    std::cerr << std::endl;
+    return false;
+  }
+  std::cerr << name << ": matches lockstep over " << expected.size()
+            << " frames" << std::endl;
+  return true;
+}
+
+// Two APUs given the same writes and status reads, one with synthesis
+// flipped on and off at random, must agree on everything the CPU can see
+bool checkSynthesisToggle() {
+  NesMemory memory;  // DMC samples are read from the benchmark ROM
+  PPU ppu(nullptr);
+  if (!loadQuietly(memory, ppu, benchmarkRom(), "generated")) return false;
+  APU reference(memory, NTSC_TIMING, 0);
+  APU toggled(memory, NTSC_TIMING, 0);
+
+  constexpr std::array<uint16_t, 22> REGISTERS = {
+      0x4000, 0x4001, 0x4002, 0x4003, 0x4004, 0x4005, 0x4006, 0x4007,
+      0x4008, 0x4009, 0x400A, 0x400B, 0x400C, 0x400D, 0x400E, 0x400F,
+      0x4010, 0x4011, 0x4012, 0x4013, 0x4015, 0x4017};
+  uint32_t state = 0x2545F491;
+  auto random = [&](uint32_t range) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state % range;
+  };
+
+  std::vector<int16_t> samples(APU::SAMPLE_RATE / 10);
+  uint64_t cycle = 0;
+  for (int step = 0; step < APU_STEPS; ++step) {
+    cycle += 1 + random(2000);
+    reference.catchUp(cycle);
+    toggled.catchUp(cycle);
+
+    bool same = true;
+    switch (random(8)) {
+      case 0:
+        toggled.setSynthesis(!toggled.getSynthesis());
+        break;
+      case 1:
+        same = reference.readStatus() == toggled.readStatus();
+        break;
+      default: {
+        uint16_t addr = REGISTERS[random(REGISTERS.size())];
+        uint8_t val = random(0x100);
+        reference.write(addr, val);
+        toggled.write(addr, val);
+        break;
+      }
+    }
+    same = same && reference.getIRQ() == toggled.getIRQ() &&
+           reference.takeStall() == toggled.takeStall() &&
+           reference.nextFrameIRQ() == toggled.nextFrameIRQ() &&
+           reference.nextDMCFetch() == toggled.nextDMCFetch();
+    if (!same) {
+      std::cerr << "apu/synthesis_toggle: differs at step " << step
+                << ", CPU cycle " << cycle << std::endl;
+      return false;
+    }
+
+    if (step % 100 != 99) continue;
+    reference.endFrame(cycle);
+    toggled.endFrame(cycle);
+    reference.readSamples(samples.data(), samples.size());
+    toggled.readSamples(samples.data(), samples.size());
+  }
+  std::cerr << "apu/synthesis_toggle: matches over " << APU_STEPS << " steps"
+            << std::endl;
+  return true;
+}
+
+// Input events take effect on the frame they are stamped with, however
+// early they were pushed
+bool checkEventInput() {
+  EventInput input;
+  for (const InputEvent& event :
+       {InputEvent{2, 0, BUTTON_A}, InputEvent{4, 0, BUTTON_A | BUTTON_B},
+        InputEvent{4, 1, BUTTON_START}, InputEvent{6, 0, 0}}) {
+    input.push(event);
+  }
+  const std::array<PortButtons, 7> expected = {{
+      {0, 0},
+      {BUTTON_A, 0},
+      {BUTTON_A, 0},
+      {BUTTON_A | BUTTON_B, BUTTON_START},
+      {BUTTON_A | BUTTON_B, BUTTON_START},
+      {0, BUTTON_START},
+      {0, BUTTON_START},
+  }};
+  for (size_t i = 0; i < expected.size(); ++i) {
+    if (input.poll(i + 1) == expected[i]) continue;
+    std::cerr << "input/stamped_frames: wrong buttons on frame " << i + 1
+              << std::endl;
+    return false;
+  }
+  std::cerr << "input/stamped_frames: matches over " << expected.size()
+            << " frames" << std::endl;
+  return true;
+}
+
+}  // namespace
+
+bool runChecks() {
+  struct Rom {
+    const char* name;
+    std::vector<char> (*build)(Region);
+  };
+  const std::array<Rom, 2> roms = {
+      Rom{"bench_rom", benchmarkRom},
+      Rom{"interrupts", interruptRom},
+  };
+
+  // PAL's CPU and PPU clocks don't divide evenly, which the others can't show
+  bool passed = true;
+  for (const Rom& rom : roms) {
+    for (Region region : {Region::NTSC, Region::PAL, Region::Dendy}) {
+      std::string name =
+          std::string(rom.name) + "/" + regionTiming(region).name;
+      std::vector<char> data = rom.build(region);
+      std::vector<FrameState> expected =
+          run(data, region, Stepping::LOCKSTEP);
+      if (expected.size() != FRAMES) {
+        std::cerr << name << ": could not be loaded in that region"
+                  << std::endl;
+        passed = false;
+        continue;
+      }
+      for (int i = 1; i < static_cast<int>(Stepping::NUM_STEPPINGS); ++i) {
+        std::vector<FrameState> actual =
+            run(data, region, static_cast<Stepping>(i));
+        passed &=
+            compare(name + "/" + STEPPING_NAMES[i], expected, actual);
+      }
+    }
+  }
+  passed &= checkSynthesisToggle();
+  passed &= checkEventInput();
+  return passed;
+}
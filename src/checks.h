@@ -0,0 +1,8 @@
+#pragma once
+
+// Runs generated ROMs every way the core can be stepped and compares the
+// state at the end of every frame against stepping everything on every CPU
+// cycle. Also the APU with synthesis flipped at random against one left on,
+// and input events against the frames they are stamped with. Differences
+// are printed, returns true if there were none
+bool runChecks();
@@ -0,0 +1,63 @@
+#include "console.h"
+
+#include <utility>
+
+#include "trace.h"
+
+Console::Console(Window* window) : ppu(window), latchNext(false) {}
+
+bool Console::loadRom(const std::string& path) {
+  if (!memory.loadRom(path, ppu)) return false;
+  powerOn();
+  return true;
+}
+
+bool Console::loadRom(std::vector<char> data, const std::string& name) {
+  if (!memory.loadRom(std::move(data), name, ppu)) return false;
+  powerOn();
+  return true;
+}
+
+void Console::powerOn() {
+  memory.setScheduler(nullptr);
+  scheduler.reset();
+  cpu = std::make_unique<CPU>(memory);
+  memory.setCPU(cpu.get());
+  apu = std::make_unique<APU>(memory, ppu.getTiming(), cpu->getCycle());
+  memory.setAPU(apu.get());
+  latchNext = false;
+}
+
+void Console::attachScheduler() {
+  scheduler = std::make_unique<Scheduler>(cpu->getCycle(), ppu.getTiming());
+  memory.setScheduler(scheduler.get());
+  scheduler->setHandler(Scheduler::PPU_EVENT, [this](uint64_t now) {
+    ppu.catchUp(scheduler->ppuCycles(now));
+    if (ppu.takeNMI()) cpu->setNMI(true);
+    scheduler->schedule(Scheduler::PPU_EVENT,
+                        scheduler->ppuTime(ppu.nextEventCycle()));
+  });
+  scheduler->schedule(Scheduler::PPU_EVENT,
+                      scheduler->ppuTime(ppu.nextEventCycle()));
+  scheduler->setHandler(Scheduler::APU_FRAME_COUNTER,
+                        [this](uint64_t) { memory.syncAPU(); });
+  scheduler->setHandler(Scheduler::DMC,
+                        [this](uint64_t) { memory.syncAPU(); });
+  memory.syncAPU();
+}
+
+void Console::step() {
+  {
+    TRACE_SCOPE("CPU");
+    cpu->run(*scheduler);
+  }
+  scheduler->dispatch(scheduler->cpuTime(cpu->getCycle()));
+}
+
+void Console::runFrame() {
+  uint64_t frame = ppu.getFrameCount();
+  if (latchNext) memory.latchInput(frame);
+  while (ppu.getFrameCount() == frame) step();
+  apu->endFrame(cpu->getCycle());
+  latchNext = true;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "apu.h"
+#include "cpu.h"
+#include "nesMemory.h"
+#include "ppu.h"
+#include "scheduler.h"
+#include "window.h"
+
+// Memory, CPU, PPU and APU wired together, stepped the way every run is: the
+// CPU runs until the scheduler's next deadline and the PPU and APU are only
+// caught up at their deadlines or when the CPU accesses them. The emulator,
+// the benchmarks and the checks all run the core through this.
+class Console {
+ private:
+  NesMemory memory;
+  PPU ppu;
+  // Made once a ROM is loaded, the CPU starts from its reset vector
+  std::unique_ptr<CPU> cpu;
+  std::unique_ptr<APU> apu;
+  std::unique_ptr<Scheduler> scheduler;
+  bool latchNext;  // A frame has run, the next one polls the input first
+
+ public:
+  // window may be nullptr to run headless
+  explicit Console(Window* window);
+  Console(const Console&) = delete;
+  Console& operator=(const Console&) = delete;
+
+  // Powers on with the ROM, replacing the CPU and APU of any earlier one
+  bool loadRom(const std::string& path);
+  // An iNES image already in memory, name is only used in messages
+  bool loadRom(std::vector<char> data, const std::string& name);
+
+  // Until this is called nothing catches the PPU up on register access, it
+  // is then the caller's to step in lockstep
+  void attachScheduler();
+  // Runs the CPU to the next deadline and dispatches what is due
+  void step();
+  // Runs the rest of the current frame and completes its audio. The input is
+  // polled before any of a frame runs, so a frame that never runs is never
+  // polled
+  void runFrame();
+
+  inline NesMemory& getMemory() { return memory; }
+  inline PPU& getPPU() { return ppu; }
+  inline CPU& getCPU() { return *cpu; }
+  inline APU& getAPU() { return *apu; }
+  inline Scheduler& getScheduler() { return *scheduler; }
+
+ private:
+  void powerOn();
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+
+// Standard controller. While strobe is high the shift register keeps
+// reloading from the buttons, once it goes low each read shifts one button
+// out, A first, then reads 1 after all eight
+class Controller {
+ private:
+  uint8_t buttons;  // Latched for the current frame
+  uint8_t shift;
+  bool strobe;
+
+ public:
+  Controller() : buttons(0), shift(0), strobe(false) {}
+
+  inline void setButtons(uint8_t val) {
+    buttons = val;
+    if (strobe) shift = buttons;
+  }
+
+  inline void write(uint8_t val) {
+    strobe = val & 0x01;
+    if (strobe) shift = buttons;
+  }
+
+  inline uint8_t read() {
+    if (strobe) shift = buttons;
+    uint8_t bit = shift & 0x01;
+    shift = (shift >> 1) | 0x80;
+    return bit;
+  }
+};
@@ -1,5 +1,6 @@
 #include "cpu.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <string>
@@ -16,8 +17,13 @@ CPU::CPU(NesMemory& memory)
       state(States::Fetch),
       IRQ(false),
       NMI(false),
+      OAM_DMA_Cycles(0),
+      OAM_DMA_Addr(0),
+      OAM_DMA_Bulk(false),
       memory(memory),
       cycle(7),
+      instructions(0),
+      dmaCycles(0),
       step(false),
       printLog(false) {
   reset();
@@ -1023,14 +1029,23 @@ void CPU::executeInstruction() {
 void CPU::executeDMA() {
   switch (state) {
     case States::OAM_DMA:
-      if (OAM_DMA_Cycles % 2 == 0) {
-        // Read
-        value = memory.read(OAM_DMA_Addr++);
-      } else {
-        // Write
-        memory.write(0x2004, value);
+      // Pages without read side effects are copied in one go, the CPU is
+      // still stalled for every cycle
+      if (OAM_DMA_Cycles == 512) {
+        OAM_DMA_Bulk = memory.bulkOAM_DMA(OAM_DMA_Addr >> 8);
+      }
+
+      if (!OAM_DMA_Bulk) {
+        if (OAM_DMA_Cycles % 2 == 0) {
+          // Read
+          value = memory.read(OAM_DMA_Addr++);
+        } else {
+          // Write
+          memory.write(0x2004, value);
+        }
       }
       OAM_DMA_Cycles--;
+      ++dmaCycles;
       if (OAM_DMA_Cycles == 0) state = States::Fetch;
       break;
     default:
@@ -1066,10 +1081,12 @@ void CPU::doCycle() {
         // Need allignment cycle if on odd cycle
         if (cycle % 2 == 0) state = States::OAM_DMA;
         (void)memory.read(pc);
+        ++dmaCycles;  // Halt and alignment cycles
         break;
       }
 
       decode(memory.read(pc++));  // State transition in Decode
+      ++instructions;
       assert(state != States::Fetch);
       break;
     case States::Accumulator:
@@ -1255,6 +1272,9 @@ void CPU::doCycle() {
     case States::Execute6:
       executeInstruction();
       break;
+    case States::OAM_DMA:
+      executeDMA();
+      break;
     default:
       error(("Invalid State: " + stateMap[state]).c_str());
       memory.dump();
@@ -1263,6 +1283,22 @@ void CPU::doCycle() {
   ++cycle;
 }
 
+void CPU::run(const Scheduler& scheduler) {
+  while (cycle < scheduler.getCPUDeadline()) {
+    // Once a bulk OAM DMA has copied its page the rest is only stall cycles
+    if (state == States::OAM_DMA && OAM_DMA_Bulk && OAM_DMA_Cycles < 512) {
+      uint64_t stall = std::min<uint64_t>(
+          OAM_DMA_Cycles, scheduler.getCPUDeadline() - cycle);
+      cycle += stall;
+      dmaCycles += stall;
+      OAM_DMA_Cycles -= stall;
+      if (OAM_DMA_Cycles == 0) state = States::Fetch;
+      continue;
+    }
+    doCycle();
+  }
+}
+
 /////////////////////////////////////////////////////////////////////////////////
 //                                Instructions
 /////////////////////////////////////////////////////////////////////////////////
@@ -1751,15 +1787,17 @@ void CPU::INT() {
       rf.breakFlag = false;
       pushStack(getStatus());
       state = States::Execute5;
+      break;
     case States::Execute5:
       if (op == Operation::IRQ) rf.irqDisable = true;
       pc = (op == Operation::NMI) ? memory.read(0xFFFA) : memory.read(0xFFFE);
       state = States::Execute6;
+      break;
     case States::Execute6: {
       if (op == Operation::NMI) NMI = false;
       uint16_t PCH =
           (op == Operation::NMI) ? memory.read(0xFFFB) : memory.read(0xFFFF);
-      pc = PCH << 8;
+      pc |= PCH << 8;
       state = States::Fetch;
       break;
     }
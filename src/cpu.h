@@ -6,6 +6,7 @@
 #include <unordered_map>
 
 #include "nesMemory.h"
+#include "scheduler.h"
 
 enum class Operation {
   ADC,
@@ -166,6 +167,7 @@ class CPU {
   bool NMI;
   int OAM_DMA_Cycles;
   uint16_t OAM_DMA_Addr;
+  bool OAM_DMA_Bulk;  // Page was copied at once, remaining cycles only stall
 
   uint16_t addr;  // For any addresses that need to be modified per cycle
   uint8_t value;
@@ -175,6 +177,8 @@ class CPU {
 
   // Debug
   uint64_t cycle;
+  uint64_t instructions;
+  uint64_t dmaCycles;  // Spent on OAM and DMC DMA
   std::string debugInfo;
   std::ofstream log;
   bool step;
@@ -189,6 +193,9 @@ class CPU {
   void reset();
 
   void doCycle();
+  // Runs until the scheduler's next deadline. The deadline can move earlier
+  // while running when a register access brings an event forward
+  void run(const Scheduler& scheduler);
 
   inline void queueOAM_DMA(uint16_t page) {
     // 256 read + 256 write + 1 dummy read +1 if on odd cycle
@@ -196,6 +203,13 @@ class CPU {
     OAM_DMA_Addr = page << 8;
   }
 
+  // Halts the CPU, e.g. for the DMC's DMA. Only the cycles pass, whatever
+  // was executing carries on afterwards
+  inline void stall(uint64_t cycles) {
+    cycle += cycles;
+    dmaCycles += cycles;
+  }
+
   inline void setNMI(bool val) { NMI = val; }
   inline void setIRQ(bool val) { IRQ = val; }
 
@@ -210,6 +224,8 @@ class CPU {
   inline void toggleLog() { printLog = !printLog; }
   inline const bool getLog() const { return printLog; }
   inline const uint64_t getCycle() const { return cycle; }
+  inline const uint64_t getInstructions() const { return instructions; }
+  inline uint64_t getDMACycles() const { return dmaCycles; }
 
  private:
   void decode(uint8_t byte);
@@ -0,0 +1,130 @@
+#include "deferredRenderer.h"
+
+#include "trace.h"
+
+DeferredRenderer::DeferredRenderer(Window* window)
+    : shadow(window),
+      logs(),
+      recording(0),
+      replaying(1),
+      pending(false),
+      stop(false),
+      worker(&DeferredRenderer::run, this) {}
+
+DeferredRenderer::~DeferredRenderer() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  }
+  ready.notify_one();
+  worker.join();
+}
+
+PPULog* DeferredRenderer::attach(std::vector<char>& rom, bool trainerPresent,
+                                 bool render) {
+  std::unique_lock<std::mutex> lock(mutex);
+  done.wait(lock, [this] { return !pending; });
+  shadow.loadRom(rom, trainerPresent);
+  shadow.setRenderFrame(render);
+  logs[recording].clear();
+  return &logs[recording];
+}
+
+PPULog* DeferredRenderer::submit(uint64_t endCycle) {
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return !pending; });
+    logs[recording].endCycle = endCycle;
+    std::swap(recording, replaying);
+    pending = true;
+  }
+  ready.notify_one();
+
+  logs[recording].clear();
+  return &logs[recording];
+}
+
+const PPU::RenderStats& DeferredRenderer::getRenderStats() {
+  std::unique_lock<std::mutex> lock(mutex);
+  done.wait(lock, [this] { return !pending; });
+  return shadow.getRenderStats();
+}
+
+DrawStats DeferredRenderer::getDrawStats() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return drawn;
+}
+
+void DeferredRenderer::run() {
+  TRACE_THREAD("Deferred renderer");
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    ready.wait(lock, [this] { return pending || stop; });
+    if (!pending) return;
+
+    lock.unlock();
+    replay(logs[replaying]);
+    lock.lock();
+
+    drawn = drawStats(shadow);
+    pending = false;
+    done.notify_one();
+  }
+}
+
+void DeferredRenderer::replay(const PPULog& log) {
+  TRACE_SCOPE("PPU replay");
+  for (const PPUEvent& event : log.events) {
+    shadow.runUntil(event.cycle);
+    apply(event, log);
+  }
+  // Finishing the frame has the shadow present it
+  shadow.runUntil(log.endCycle);
+}
+
+void DeferredRenderer::apply(const PPUEvent& event, const PPULog& log) {
+  uint8_t val = event.value;
+  switch (event.type) {
+    case PPUEvent::Read:
+      if (event.reg == 2) shadow.readstatus();
+      if (event.reg == 7) shadow.readdata();
+      break;
+    case PPUEvent::Write:
+      switch (event.reg) {
+        case 0:
+          shadow.writectrl(val);
+          break;
+        case 1:
+          shadow.writemask(val);
+          break;
+        case 3:
+          shadow.writeOAMAddr(val);
+          break;
+        case 4:
+          shadow.writeOAMData(val);
+          break;
+        case 5:
+          shadow.writescroll(val);
+          break;
+        case 6:
+          shadow.writeaddr(val);
+          break;
+        case 7:
+          shadow.writedata(val);
+          break;
+      }
+      break;
+    case PPUEvent::OAMBlock:
+      shadow.writeOAMBlock(log.blocks.data() + event.value);
+      break;
+    case PPUEvent::CharacterBank:
+      shadow.setCharacterBank(event.reg, event.value);
+      break;
+    case PPUEvent::SetMirroring:
+      shadow.setMirroring(static_cast<PPU::Mirroring>(event.value));
+      break;
+    case PPUEvent::RenderFrame:
+      shadow.setRenderFrame(event.value);
+      break;
+  }
+}
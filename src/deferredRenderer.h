@@ -0,0 +1,60 @@
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ppu.h"
+#include "ppuLog.h"
+#include "stats.h"
+#include "window.h"
+
+// Rasterizes frames on a worker thread. The core PPU stops drawing and
+// instead records what the CPU does to it, at the end of each frame the log
+// is handed to a shadow PPU that replays it cycle for cycle and draws the
+// frame while the core moves on to the next one. Sprite zero hit, status and
+// NMI still come from the core, the shadow's copies are thrown away.
+class DeferredRenderer {
+ private:
+  PPU shadow;
+
+  // One log is being recorded while the other is replayed
+  std::array<PPULog, 2> logs;
+  int recording;
+  int replaying;
+
+  std::mutex mutex;
+  std::condition_variable ready;  // A log was submitted, or stopping
+  std::condition_variable done;   // The submitted log has been replayed
+  bool pending;
+  bool stop;
+  DrawStats drawn;  // The shadow's, as of the last frame replayed
+
+  std::thread worker;
+
+ public:
+  DeferredRenderer(Window* window);
+  ~DeferredRenderer();
+
+  // Gives the shadow the core's starting state, returns the log to record
+  // the first frame into. Only valid before the core has run
+  PPULog* attach(std::vector<char>& rom, bool trainerPresent, bool render);
+
+  // Hands off the finished frame and returns the log for the next. Waits if
+  // the worker is still on the previous frame so it is never more than one
+  // frame behind
+  PPULog* submit(uint64_t endCycle);
+
+  // Waits for the worker to finish the frame it is on
+  const PPU::RenderStats& getRenderStats();
+  // Doesn't wait, can be a frame behind
+  DrawStats getDrawStats();
+
+ private:
+  void run();
+  void replay(const PPULog& log);
+  void apply(const PPUEvent& event, const PPULog& log);
+};
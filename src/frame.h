@@ -0,0 +1,22 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+constexpr size_t NESWIDTH = 256;
+constexpr size_t NESHEIGHT = 240;
+
+// Pixels are 6 bit NES color indices. Greyscale and emphasis come from the
+// PPUMASK value each scanline was rendered with, the Palette converts both
+// into native pixels when a frame is presented.
+struct Frame {
+  std::array<uint8_t, (NESWIDTH * NESHEIGHT)> pixels;
+  std::array<uint8_t, NESHEIGHT> masks{};
+  uint64_t number = 0;
+
+  inline void setPixel(size_t x, size_t y, uint8_t color) {
+    pixels[x + (y * NESWIDTH)] = color;
+  }
+  inline void setMask(size_t y, uint8_t mask) { masks[y] = mask; }
+};
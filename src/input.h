@@ -0,0 +1,64 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "spscQueue.h"
+
+// Standard controller buttons in the order they are shifted out
+enum Button : uint8_t {
+  BUTTON_A = 0x01,
+  BUTTON_B = 0x02,
+  BUTTON_SELECT = 0x04,
+  BUTTON_START = 0x08,
+  BUTTON_UP = 0x10,
+  BUTTON_DOWN = 0x20,
+  BUTTON_LEFT = 0x40,
+  BUTTON_RIGHT = 0x80,
+};
+
+constexpr int NUM_PORTS = 2;
+using PortButtons = std::array<uint8_t, NUM_PORTS>;
+
+// Full button state of a port, applied from the start of frame onwards
+struct InputEvent {
+  uint64_t frame;
+  uint8_t port;
+  uint8_t buttons;
+};
+
+// Where the controllers' buttons come from. Polled once at the start of
+// every frame on the emulation thread, what it returns holds for the whole
+// frame so a run only depends on the sequence of polls
+class InputSource {
+ public:
+  virtual ~InputSource() = default;
+  virtual PortButtons poll(uint64_t frame) = 0;
+};
+
+// Timestamped events pushed from any one other thread without locking, used
+// for live input from the window and for driving the emulator from code
+class EventInput : public InputSource {
+ private:
+  SPSCQueue<InputEvent, 256> events;
+  InputEvent pending;  // Popped but for a later frame
+  bool hasPending;
+  PortButtons buttons;
+
+ public:
+  EventInput() : pending(), hasPending(false), buttons() {}
+
+  // Producer thread. Returns false if the queue is full
+  inline bool push(const InputEvent& event) { return events.push(event); }
+
+  // Emulation thread
+  PortButtons poll(uint64_t frame) override {
+    while (hasPending || events.pop(pending)) {
+      hasPending = true;
+      if (pending.frame > frame) break;
+      buttons[pending.port % NUM_PORTS] = pending.buttons;
+      hasPending = false;
+    }
+    return buttons;
+  }
+};
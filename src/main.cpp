@@ -1,19 +1,112 @@
+#include <array>
+#include <chrono>
 #include <cstdint>
 #include <cstring>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <vector>
 
+#include "apu.h"
+#include "audioOutput.h"
+#include "audioWriter.h"
+#include "console.h"
 #include "cpu.h"
+#include "deferredRenderer.h"
+#include "input.h"
+#include "movie.h"
 #include "nesMemory.h"
 #include "ppu.h"
+#include "stats.h"
+#include "trace.h"
 #include "utils.h"
 #include "window.h"
 
+struct Options {
+  std::string romPath = "roms/nestest.nes";
+  bool headless = false;  // No window, menu or pacing
+  uint64_t frames = 0;    // Headless runs stop after this many, 0 never
+  std::string wavPath;
+  std::string pcmPath;
+  std::string playPath;      // Movie to play back, FM2 or native
+  std::string recordPath;    // Where to save the input of this run
+  std::string tracePath;     // Chrome trace, needs a build with -Dtrace=true
+  std::string statsPath;     // Prometheus text, rewritten every interval
+  double statsInterval = 5;  // Seconds, 0 only reports at the end
+};
+
+static void printUsage(const char* program) {
+  std::cout << "Usage: " << program << " [options]\n"
+            << "  --rom <path>     ROM to load\n"
+            << "  --headless       Run without a window as fast as possible\n"
+            << "  --frames <n>     Stop a headless run after n frames, by\n"
+            << "                   default where a played movie ends\n"
+            << "  --wav <path>     Record audio as WAV\n"
+            << "  --pcm <path>     Record audio as raw signed 16 bit PCM,\n"
+            << "                   instead of --wav\n"
+            << "  --play <path>    Play back an input movie (.fm2 or native)\n"
+            << "  --record <path>  Record input to a movie (.fm2 or native)\n"
+            << "  --trace <path>   Write a Chrome trace of where time went\n"
+            << "  --stats <path>   Export live statistics as Prometheus text\n"
+            << "  --stats-interval <s>\n"
+            << "                   How often statistics are printed when\n"
+            << "                   headless and exported, default 5\n";
+}
+
+static bool parseOptions(int argc, char** argv, Options& options) {
+  // The number conversions throw on anything that isn't a number
+  try {
+    for (int i = 1; i < argc; ++i) {
+      std::string arg = argv[i];
+      bool hasValue = i + 1 < argc;
+      if (arg == "--headless") {
+        options.headless = true;
+      } else if (arg == "--rom" && hasValue) {
+        options.romPath = argv[++i];
+      } else if (arg == "--frames" && hasValue) {
+        options.frames = std::stoull(argv[++i]);
+      } else if (arg == "--wav" && hasValue) {
+        options.wavPath = argv[++i];
+      } else if (arg == "--pcm" && hasValue) {
+        options.pcmPath = argv[++i];
+      } else if (arg == "--play" && hasValue) {
+        options.playPath = argv[++i];
+      } else if (arg == "--record" && hasValue) {
+        options.recordPath = argv[++i];
+      } else if (arg == "--trace" && hasValue) {
+        options.tracePath = argv[++i];
+      } else if (arg == "--stats" && hasValue) {
+        options.statsPath = argv[++i];
+      } else if (arg == "--stats-interval" && hasValue) {
+        options.statsInterval = std::stod(argv[++i]);
+      } else {
+        printUsage(argv[0]);
+        return false;
+      }
+    }
+  } catch (const std::logic_error&) {
+    printUsage(argv[0]);
+    return false;
+  }
+  if (!options.wavPath.empty() && !options.pcmPath.empty()) {
+    std::cout << "Only one of --wav and --pcm can be given" << std::endl;
+    return false;
+  }
+  return true;
+}
+
 int main(int argc, char** argv) {
-  Window win;
+  Options options;
+  if (!parseOptions(argc, argv, options)) return 1;
 
-  NesMemory memory;
-  PPU ppu(&win);
+  std::unique_ptr<Window> win;
+  if (!options.headless) win = std::make_unique<Window>();
+
+  Console console(win.get());
+  NesMemory& memory = console.getMemory();
+  PPU& ppu = console.getPPU();
 
   std::string romPath;
   std::vector<char> rom;
@@ -23,24 +116,29 @@ LoadRom:
     romPath = "";
     // std::cout << "Load Rom: ";
     // std::cin >> romPath;
-    romPath = "roms/nestest.nes";
+    romPath = options.romPath;
 
     if (std::cin.eof() || romPath == "") {
       std::cout << std::endl;
       return 0;
     }
 
-    if (!memory.loadRom(romPath, ppu)) {
+    if (!console.loadRom(romPath)) {
+      if (options.headless) return 1;
       continue;
     }
     break;
   }
 
-  CPU cpu(memory);
-  memory.setCPU(&cpu);
+  CPU& cpu = console.getCPU();
+  APU& apu = console.getAPU();
+
+  bool limitSpeed = !options.headless;
+  bool deferRendering = false;
+  bool audioEnabled = !options.headless;
 
   std::string message;
-  while (true) {
+  while (!options.headless) {
     std::cout << "[1] Load New ROM\n";
     std::cout << "[2] Set Starting PC [" << to_hex(cpu.getPC()) << "]\n";
     std::cout << "[3] Run ROM\n";
@@ -48,6 +146,15 @@ LoadRom:
               << (cpu.getStep() ? "Enabled" : "Disabled") << "]\n";
     std::cout << "[5] Toggle Logging, ["
               << (cpu.getLog() ? "Enabled" : "Disabled") << "]\n";
+    std::cout << "[6] Toggle Rendering, ["
+              << (ppu.getRenderFrame() ? "Enabled" : "Disabled") << "]\n";
+    std::cout << "[7] Load Palette\n";
+    std::cout << "[8] Toggle Speed Limit, ["
+              << (limitSpeed ? "Enabled" : "Disabled") << "]\n";
+    std::cout << "[9] Toggle Deferred Rendering, ["
+              << (deferRendering ? "Enabled" : "Disabled") << "]\n";
+    std::cout << "[10] Toggle Audio, ["
+              << (audioEnabled ? "Enabled" : "Disabled") << "]\n";
 
     std::cout << "\n> ";
     std::cin >> message;
@@ -65,17 +172,201 @@ LoadRom:
       cpu.toggleStep();
     } else if (message == "5") {
       cpu.toggleLog();
+    } else if (message == "6") {
+      ppu.setRenderFrame(!ppu.getRenderFrame());
+    } else if (message == "7") {
+      std::cout << "Palette Path: ";
+      std::cin >> message;
+      win->loadPalette(message);
+    } else if (message == "8") {
+      limitSpeed = !limitSpeed;
+    } else if (message == "9") {
+      deferRendering = !deferRendering;
+    } else if (message == "10") {
+      audioEnabled = !audioEnabled;
     }
   }
 
-  exit(0);
+  // Frames are drawn on a worker thread from what the PPU recorded
+  std::unique_ptr<DeferredRenderer> renderer;
+  if (deferRendering) {
+    renderer = std::make_unique<DeferredRenderer>(win.get());
+    ppu.setRecorder(renderer.get());
+  }
 
-  while (true) {
-    // PPU runs 3 times for every 1 cycle of CPU
-    // if(ppu.getCycles() % 3 == 0)
-    cpu.doCycle();
-    // bool NMI = ppu.doCycle();
-    // if(NMI) cpu.setNMI(NMI);
+  // Recording never touches an audio device
+  std::unique_ptr<AudioWriter> recording;
+  if (!options.wavPath.empty() || !options.pcmPath.empty()) {
+    bool wav = !options.wavPath.empty();
+    recording = std::make_unique<AudioWriter>(
+        wav ? options.wavPath : options.pcmPath,
+        wav ? AudioWriter::Format::WAV : AudioWriter::Format::PCM,
+        APU::SAMPLE_RATE);
+    if (!recording->isOpen()) return 1;
   }
-  return 0;
+
+  // Without audio the APU only keeps what the game can see
+  std::unique_ptr<AudioOutput> audio;
+  apu.setSynthesis(audioEnabled || recording);
+  if (audioEnabled) audio = std::make_unique<AudioOutput>(APU::SAMPLE_RATE);
+
+  auto running = [&]() {
+    if (win) return win->isOpen();
+    return options.frames == 0 || ppu.getFrameCount() < options.frames;
+  };
+
+  auto emulate = [&]() {
+    TRACE_THREAD("Emulation");
+    const std::chrono::nanoseconds FRAME_PERIOD(framePeriod(ppu.getTiming()));
+    auto nextFrame = std::chrono::steady_clock::now();
+
+    std::vector<int16_t> samples(APU::SAMPLE_RATE / 10);
+
+    // Statistics are printed when headless and exported in any mode
+    const auto STATS_PERIOD =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::duration<double>(options.statsInterval));
+    bool reportStats = STATS_PERIOD.count() > 0 &&
+                       (!win || !options.statsPath.empty());
+    auto statsStart = std::chrono::steady_clock::now();
+    auto nextStats = statsStart + STATS_PERIOD;
+    // With deferred rendering the shadow PPU draws, not this one
+    auto drawn = [&]() {
+      return renderer ? renderer->getDrawStats() : drawStats(ppu);
+    };
+    Stats lastStats = collectStats(cpu, ppu, memory, drawn(), 0);
+
+    console.attachScheduler();
+    TRACE_FRAME(ppu.getFrameCount());
+    while (running()) {
+      console.runFrame();
+      uint64_t frame = ppu.getFrameCount();
+      TRACE_FRAME(frame);
+      size_t count = apu.readSamples(samples.data(), samples.size());
+      if (recording) recording->write(samples.data(), count);
+      if (audio) audio->push(samples.data(), count);
+
+      // A frame that won't run isn't polled, so recordings end where the
+      // run did
+      if (!running()) break;
+      if (win) win->setCurrentFrame(frame);
+
+      auto now = std::chrono::steady_clock::now();
+      if (reportStats && now >= nextStats) {
+        TRACE_SCOPE("Stats");
+        nextStats = now + STATS_PERIOD;
+        std::chrono::duration<double> wall = now - statsStart;
+        Stats stats = collectStats(cpu, ppu, memory, drawn(), wall.count());
+        if (!win) printStats(std::cout, stats, lastStats);
+        if (!options.statsPath.empty()) {
+          writePrometheus(options.statsPath, stats);
+        }
+        lastStats = stats;
+      }
+
+      if (!win || !limitSpeed) continue;
+      if (audio && audio->isOpen()) {
+        // The audio device's clock paces emulation, rate control only has to
+        // absorb the jitter
+        TRACE_SCOPE("Sleep");
+        std::this_thread::sleep_for(audio->excess());
+        apu.setRateRatio(audio->rateRatio());
+        continue;
+      }
+      nextFrame += FRAME_PERIOD;
+      if (now > nextFrame + FRAME_PERIOD * 4) {
+        nextFrame = now;  // Too far behind to catch up
+      } else {
+        TRACE_SCOPE("Sleep");
+        std::this_thread::sleep_until(nextFrame);
+      }
+    }
+  };
+
+  // Input comes from a movie or the window, nothing is pressed in a headless
+  // run without a movie. A movie's first frame lands on the first frame
+  // latched after power on
+  InputSource* input = win ? &win->getInput() : nullptr;
+  Movie playback;
+  std::unique_ptr<MoviePlayer> player;
+  if (!options.playPath.empty()) {
+    if (!playback.load(options.playPath)) return 1;
+    player = std::make_unique<MoviePlayer>(playback, ppu.getFrameCount() + 1);
+    input = player.get();
+    if (options.frames == 0) options.frames = player->endFrame();
+  }
+  Movie recorded;
+  recorded.setRomFilename(romPath);
+  std::unique_ptr<MovieRecorder> recorder;
+  if (!options.recordPath.empty()) {
+    recorder = std::make_unique<MovieRecorder>(input, recorded);
+    input = recorder.get();
+  }
+  memory.setInputSource(input);
+
+  auto start = std::chrono::steady_clock::now();
+  if (win) {
+    // Emulation runs on its own thread so presentation can never stall it,
+    // the window is driven from this thread
+    std::thread emulation(emulate);
+    win->run();
+    emulation.join();
+  } else {
+    emulate();
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  if (options.headless) {
+    // Comparable across builds as long as the ROM and movie are the same
+    const std::array<uint8_t, 0x800>& ram = memory.getRAM();
+    const Frame& lastFrame = ppu.getFrame();
+    double seconds = elapsed.count();
+    std::cout << "Frames: " << ppu.getFrameCount()
+              << ", CPU cycles: " << cpu.getCycle()
+              << ", instructions: " << cpu.getInstructions() << "\n"
+              << "Time: " << seconds << "s, "
+              << ppu.getFrameCount() / seconds << " frames/s, "
+              << cpu.getInstructions() / seconds << " instructions/s\n"
+              << "RAM hash: " << std::hex << fnv1a(ram.data(), ram.size())
+              << ", frame hash: "
+              << fnv1a(lastFrame.pixels.data(), lastFrame.pixels.size())
+              << std::dec << std::endl;
+  }
+  if (recorder) recorded.save(options.recordPath);
+  // A truncated recording must not pass a golden check
+  int status = 0;
+  if (recording) {
+    if (recording->close()) {
+      std::cout << "Audio samples: " << recording->getSamplesWritten()
+                << ", hash: " << std::hex << recording->getHash() << std::dec
+                << std::endl;
+    } else {
+      status = 1;
+    }
+  }
+
+  if (audio && (audio->getUnderruns() > 0 || audio->getDropped() > 0)) {
+    std::cout << "Audio underruns: " << audio->getUnderruns()
+              << ", samples dropped: " << audio->getDropped() << std::endl;
+  }
+
+  const PPU::RenderStats& stats =
+      renderer ? renderer->getRenderStats() : ppu.getRenderStats();
+  uint64_t lines = stats.linesDrawn + stats.linesReused;
+  if (lines > 0) {
+    std::cout << "Scanlines reused: " << stats.linesReused * 100 / lines
+              << "%" << std::endl;
+  }
+  if (!options.statsPath.empty()) {
+    // The renderer has finished every frame after getRenderStats
+    DrawStats draw = renderer ? renderer->getDrawStats() : drawStats(ppu);
+    writePrometheus(options.statsPath,
+                    collectStats(cpu, ppu, memory, draw, elapsed.count()));
+  }
+
+  // Everything that records has stopped by now, the deferred renderer
+  // finished its last frame for the stats above
+  if (!options.tracePath.empty()) trace::writeChromeTrace(options.tracePath);
+  return status;
 }
@@ -0,0 +1,203 @@
+#include "movie.h"
+
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include "trace.h"
+
+namespace {
+
+// FM2 lists a port's buttons from bit 7 down
+constexpr char FM2_BUTTONS[9] = "RLDUTSBA";
+
+constexpr char NATIVE_MAGIC[4] = {'N', 'E', 'S', 'M'};
+constexpr uint8_t NATIVE_VERSION = 1;
+
+bool endsWith(const std::string& text, const std::string& suffix) {
+  if (text.size() < suffix.size()) return false;
+  for (size_t i = 0; i < suffix.size(); ++i) {
+    char c = text[text.size() - suffix.size() + i];
+    if (std::tolower(static_cast<unsigned char>(c)) != suffix[i]) return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+Movie::Format Movie::formatOf(const std::string& path) {
+  return endsWith(path, ".fm2") ? Format::FM2 : Format::Native;
+}
+
+bool Movie::load(const std::string& path) {
+  TRACE_SCOPE("Movie load");
+  std::ifstream file(path, std::ifstream::binary);
+  if (file.fail()) {
+    std::cout << "Failed to Open \"" << path << "\"" << std::endl;
+    return false;
+  }
+  frames.clear();
+  return formatOf(path) == Format::FM2 ? loadFM2(file, path)
+                                       : loadNative(file, path);
+}
+
+bool Movie::save(const std::string& path) const {
+  TRACE_SCOPE("Movie save");
+  std::ofstream file(path, std::ofstream::binary | std::ofstream::trunc);
+  if (file.fail()) {
+    std::cout << "Failed to Open \"" << path << "\"" << std::endl;
+    return false;
+  }
+  bool saved =
+      formatOf(path) == Format::FM2 ? saveFM2(file) : saveNative(file);
+  if (!saved || !file.flush()) {
+    std::cout << "Failed to Write \"" << path << "\"" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool Movie::loadFM2(std::ifstream& file, const std::string& path) {
+  bool warnedCommands = false;
+  std::string line;
+  while (std::getline(file, line)) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (line.empty()) continue;
+
+    if (line[0] != '|') {
+      // Header, "key value"
+      std::istringstream header(line);
+      std::string key, value;
+      header >> key >> value;
+      bool unsupported = (key == "binary" && value != "0") ||
+                         (key == "fourscore" && value != "0") ||
+                         (key == "savestate" && !value.empty()) ||
+                         ((key == "port0" || key == "port1") &&
+                          value != "0" && value != "1");
+      if (unsupported) {
+        std::cout << "\"" << path << "\" uses unsupported \"" << line << "\""
+                  << std::endl;
+        return false;
+      }
+      continue;
+    }
+
+    // |commands|port0|port1|port2|
+    std::array<std::string, 4> fields;
+    size_t start = 1;
+    for (std::string& field : fields) {
+      size_t end = line.find('|', start);
+      if (end == std::string::npos) break;
+      field = line.substr(start, end - start);
+      start = end + 1;
+    }
+    int commands = 0;
+    if (!fields[0].empty()) {
+      const char* end = fields[0].data() + fields[0].size();
+      std::from_chars_result parsed =
+          std::from_chars(fields[0].data(), end, commands);
+      if (parsed.ec != std::errc() || parsed.ptr != end) {
+        std::cout << "\"" << path << "\" is not a valid movie" << std::endl;
+        return false;
+      }
+    }
+    if (commands != 0 && !warnedCommands) {
+      std::cout << "\"" << path << "\" resets the console, which is ignored"
+                << std::endl;
+      warnedCommands = true;
+    }
+
+    PortButtons buttons = {};
+    for (int port = 0; port < NUM_PORTS; ++port) {
+      const std::string& field = fields[port + 1];
+      for (size_t i = 0; i < field.size() && i < 8; ++i) {
+        if (field[i] != '.' && field[i] != ' ') buttons[port] |= 0x80 >> i;
+      }
+    }
+    frames.push_back(buttons);
+  }
+  return true;
+}
+
+bool Movie::loadNative(std::ifstream& file, const std::string& path) {
+  std::array<char, 12> header;
+  if (!file.read(header.data(), header.size()) ||
+      memcmp(header.data(), NATIVE_MAGIC, 4) != 0 ||
+      header[4] != NATIVE_VERSION) {
+    std::cout << "\"" << path << "\" is not a valid movie" << std::endl;
+    return false;
+  }
+  size_t ports = static_cast<uint8_t>(header[5]);
+  uint32_t count = 0;
+  for (int i = 0; i < 4; ++i) {
+    count |= static_cast<uint32_t>(static_cast<uint8_t>(header[8 + i]))
+             << (i * 8);
+  }
+
+  // The header is only trusted as far as the file backs it up
+  std::streampos start = file.tellg();
+  file.seekg(0, std::ifstream::end);
+  uint64_t remaining = static_cast<uint64_t>(file.tellg() - start);
+  file.seekg(start);
+  if (ports == 0 || static_cast<uint64_t>(count) * ports > remaining) {
+    std::cout << "\"" << path << "\" is not a valid movie" << std::endl;
+    return false;
+  }
+
+  std::vector<char> data(static_cast<size_t>(count) * ports);
+  if (!file.read(data.data(), data.size())) {
+    std::cout << "Failed to Read \"" << path << "\"" << std::endl;
+    return false;
+  }
+  frames.resize(count);
+  for (size_t frame = 0; frame < count; ++frame) {
+    for (size_t port = 0; port < ports && port < NUM_PORTS; ++port) {
+      frames[frame][port] = data[frame * ports + port];
+    }
+  }
+  return true;
+}
+
+bool Movie::saveFM2(std::ofstream& file) const {
+  file << "version 3\n"
+       << "emuVersion 22020\n"
+       << "rerecordCount 0\n"
+       << "palFlag 0\n"
+       << "romFilename " << romFilename << "\n"
+       << "guid 00000000-0000-0000-0000-000000000000\n"
+       << "fourscore 0\n"
+       << "port0 1\n"
+       << "port1 1\n"
+       << "port2 0\n";
+  for (const PortButtons& buttons : frames) {
+    file << "|0";
+    for (uint8_t port : buttons) {
+      file << '|';
+      for (int i = 0; i < 8; ++i) {
+        file << ((port & (0x80 >> i)) ? FM2_BUTTONS[i] : '.');
+      }
+    }
+    file << "||\n";
+  }
+  return file.good();
+}
+
+bool Movie::saveNative(std::ofstream& file) const {
+  std::array<char, 12> header = {};
+  memcpy(header.data(), NATIVE_MAGIC, 4);
+  header[4] = NATIVE_VERSION;
+  header[5] = NUM_PORTS;
+  for (int i = 0; i < 4; ++i) header[8 + i] = (frames.size() >> (i * 8));
+  file.write(header.data(), header.size());
+
+  std::vector<char> data;
+  data.reserve(frames.size() * NUM_PORTS);
+  for (const PortButtons& buttons : frames) {
+    data.insert(data.end(), buttons.begin(), buttons.end());
+  }
+  file.write(data.data(), data.size());
+  return file.good();
+}
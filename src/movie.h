@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "input.h"
+
+// Buttons for every frame of a run from power on. Reads and writes FCEUX's
+// text FM2 format and a compact native one, picked by file extension.
+// Savestate anchored movies, resets and anything but standard controllers
+// aren't supported.
+class Movie {
+ public:
+  enum class Format {
+    FM2,
+    Native,  // "NESM", version, ports, 4 byte frame count then 1 byte per port
+  };
+
+ private:
+  std::vector<PortButtons> frames;
+  std::string romFilename;  // Informational, written to FM2 headers
+
+ public:
+  static Format formatOf(const std::string& path);
+
+  bool load(const std::string& path);
+  bool save(const std::string& path) const;
+
+  inline void setRomFilename(const std::string& name) { romFilename = name; }
+  inline void append(const PortButtons& buttons) { frames.push_back(buttons); }
+  inline size_t size() const { return frames.size(); }
+  inline const PortButtons& operator[](size_t i) const { return frames[i]; }
+
+ private:
+  bool loadFM2(std::ifstream& file, const std::string& path);
+  bool loadNative(std::ifstream& file, const std::string& path);
+  bool saveFM2(std::ofstream& file) const;
+  bool saveNative(std::ofstream& file) const;
+};
+
+// Plays a movie back, its first frame is applied on firstFrame and nothing
+// is pressed once it runs out
+class MoviePlayer : public InputSource {
+ private:
+  const Movie& movie;
+  uint64_t firstFrame;
+
+ public:
+  MoviePlayer(const Movie& movie, uint64_t firstFrame)
+      : movie(movie), firstFrame(firstFrame) {}
+
+  // The frame after the last one the movie has input for
+  inline uint64_t endFrame() const { return firstFrame + movie.size(); }
+
+  PortButtons poll(uint64_t frame) override {
+    if (frame < firstFrame || frame - firstFrame >= movie.size()) return {};
+    return movie[frame - firstFrame];
+  }
+};
+
+// Passes another source through, keeping everything it returned
+class MovieRecorder : public InputSource {
+ private:
+  InputSource* source;  // nullptr records nothing pressed
+  Movie& movie;
+
+ public:
+  MovieRecorder(InputSource* source, Movie& movie)
+      : source(source), movie(movie) {}
+
+  PortButtons poll(uint64_t frame) override {
+    PortButtons buttons = source ? source->poll(frame) : PortButtons{};
+    movie.append(buttons);
+    return buttons;
+  }
+};
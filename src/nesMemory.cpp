@@ -7,10 +7,13 @@
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <utility>
 #include <vector>
 
+#include "apu.h"
 #include "cpu.h"
 #include "ppu.h"
+#include "trace.h"
 #include "utils.h"
 
 // Set of the currently supported Mappers
@@ -19,7 +22,7 @@ std::unordered_set<uint16_t> NesMemory::supportedMappers = {0x00};
 constexpr size_t ROMLOCATION = 0x3FE0;
 
 bool NesMemory::loadRom(const std::string& romPath, PPU& ppu) {
-  NesMemory::romPath = romPath;
+  TRACE_SCOPE("Load ROM");
   std::ifstream romFile(romPath, std::ifstream::binary | std::ifstream::ate);
   if (romFile.fail()) {
     std::cout << "Failed to Open \"" << romPath << "\"" << std::endl;
@@ -28,11 +31,18 @@ bool NesMemory::loadRom(const std::string& romPath, PPU& ppu) {
   std::streamsize size = romFile.tellg();
   romFile.seekg(0, std::ios::beg);
 
-  rom = std::vector<char>(size);
-  if (!romFile.read(rom.data(), size)) {
+  std::vector<char> data(size);
+  if (!romFile.read(data.data(), size)) {
     std::cout << "Failed to Read \"" << romPath << "\"" << std::endl;
     return false;
   }
+  return loadRom(std::move(data), romPath, ppu);
+}
+
+bool NesMemory::loadRom(std::vector<char> data, const std::string& romPath,
+                        PPU& ppu) {
+  NesMemory::romPath = romPath;
+  rom = std::move(data);
 
   constexpr char const NES_BYTES[4] = {'N', 'E', 'S', 0x1A};
   bool headerFound = !memcmp(rom.data(), NES_BYTES, 4);
@@ -45,7 +55,12 @@ bool NesMemory::loadRom(const std::string& romPath, PPU& ppu) {
   characterSize = rom[5];
 
   // Flags 6
-  mirroring = (rom[6] & 0x01) ? Horizontal : Vertical;
+  if (rom[6] & 0x08) {
+    mirroring = PPU::Mirroring::FourScreen;
+  } else {
+    mirroring = (rom[6] & 0x01) ? PPU::Mirroring::Vertical
+                                : PPU::Mirroring::Horizontal;
+  }
   persistent = rom[6] & 0x02;
   trainerPresent = rom[6] & 0x04;
   mapper = static_cast<uint8_t>(rom[6]) >> 4;
@@ -60,8 +75,11 @@ bool NesMemory::loadRom(const std::string& romPath, PPU& ppu) {
   std::cout << "\n\n";
   std::cout << "Rom Size: " << programSize * 16 << "KB" << std::endl;
   std::cout << "CHR Size: " << characterSize * 8 << "KB" << std::endl;
-  std::cout << (mirroring == Horizontal ? "Horizontal" : "Vertical")
+  std::cout << (mirroring == PPU::Mirroring::FourScreen ? "Four Screen"
+                 : mirroring == PPU::Mirroring::Vertical ? "Vertical"
+                                                          : "Horizontal")
             << " Mirroring" << std::endl;
+  std::cout << "Region: " << regionTiming(headerRegion(rom)).name << std::endl;
   std::cout << "Persistent Memory " << (persistent ? "Present" : "Not Present")
             << std::endl;
   std::cout << "Trainer " << (trainerPresent ? "Present" : "Not Present")
@@ -142,38 +160,80 @@ const uint8_t& NesMemory::operator[](size_t i) const {
   exit(1);
 }
 
+void NesMemory::syncPPU() {
+  if (!scheduler) return;
+  ppu->catchUp(scheduler->ppuCycles(scheduler->cpuTime(cpu->getCycle())));
+}
+
+void NesMemory::reschedulePPU() {
+  if (!scheduler) return;
+  scheduler->schedule(Scheduler::PPU_EVENT,
+                      scheduler->ppuTime(ppu->nextEventCycle()));
+}
+
+void NesMemory::syncAPU() {
+  if (!apu) return;
+  apu->catchUp(cpu->getCycle());
+  cpu->stall(apu->takeStall());
+  cpu->setIRQ(apu->getIRQ());
+  if (!scheduler) return;
+  scheduler->scheduleCycle(Scheduler::APU_FRAME_COUNTER, apu->nextFrameIRQ());
+  scheduler->scheduleCycle(Scheduler::DMC, apu->nextDMCFetch());
+}
+
 void NesMemory::write(uint16_t addr, uint8_t val) {
   if (addr < 0x4000 && addr >= 0x2000) {
+    ++ppuWrites[addr & 0x07];
     addr %= 0x2008;
+    syncPPU();
+  }
+  if (apu && addr >= 0x4000 && addr <= 0x4017 && addr != 0x4014 &&
+      addr != 0x4016) {
+    syncAPU();
+    apu->write(addr, val);
+    syncAPU();
+    return;
   }
   switch (addr) {
     case 0x2000:
       ppu->writectrl(val);
+      reschedulePPU();
       break;
     case 0x2001:
       ppu->writemask(val);
+      reschedulePPU();
       break;
     case 0x2002:
       ppu->writestatus(val);
+      reschedulePPU();
       break;
     case 0x2003:
       ppu->writeOAMAddr(val);
+      reschedulePPU();
       break;
     case 0x2004:
       ppu->writeOAMData(val);
+      reschedulePPU();
       break;
     case 0x2005:
       ppu->writescroll(val);
+      reschedulePPU();
       break;
     case 0x2006:
       ppu->writeaddr(val);
+      reschedulePPU();
       break;
     case 0x2007:
       ppu->writedata(val);
+      reschedulePPU();
       break;
     case 0x4014:
       cpu->queueOAM_DMA(val);
       break;
+    case 0x4016:
+      for (Controller& controller : controllers) controller.write(val);
+      operator[](addr) = val;
+      break;
     default:
       operator[](addr) = val;
       return;
@@ -182,7 +242,9 @@ void NesMemory::write(uint16_t addr, uint8_t val) {
 
 uint8_t NesMemory::read(uint16_t addr) {
   if (addr < 0x4000 && addr >= 0x2000) {
+    ++ppuReads[addr & 0x07];
     addr %= 0x2008;
+    syncPPU();
   }
   switch (addr) {
     case 0x2000:
@@ -203,11 +265,33 @@ uint8_t NesMemory::read(uint16_t addr) {
       return ppu->readdata();
     case 0x4014:
       return ppu->readOAMDMA();
+    case 0x4015:
+      if (apu) {
+        syncAPU();
+        uint8_t status = apu->readStatus();
+        syncAPU();
+        return status;
+      }
+      return operator[](addr);
+    case 0x4016:
+    case 0x4017:
+      // Upper bits are open bus, usually the high byte of the address
+      return 0x40 | controllers[addr - 0x4016].read();
     default:
       return operator[](addr);
   }
 }
 
+bool NesMemory::bulkOAM_DMA(uint8_t page) {
+  // Internal RAM, cartridge RAM and ROM pages are contiguous and plain memory
+  if (page >= 0x20 && page < 0x60) return false;
+
+  syncPPU();
+  ppu->writeOAMBlock(&operator[](static_cast<uint16_t>(page) << 8));
+  reschedulePPU();
+  return true;
+}
+
 void NesMemory::dump() {
   std::ofstream file("NES.dump");
 
@@ -7,8 +7,12 @@
 #include <unordered_set>
 #include <vector>
 
+#include "controller.h"
+#include "input.h"
 #include "ppu.h"
+#include "scheduler.h"
 
+class APU;
 class CPU;
 
 class NesMemory {
@@ -19,6 +23,15 @@ class NesMemory {
 
   PPU* ppu;
   CPU* cpu;
+  APU* apu;
+  Scheduler* scheduler;
+
+  std::array<Controller, NUM_PORTS> controllers;
+  InputSource* input;
+
+  // By register, $2000-$2007
+  std::array<uint64_t, 8> ppuReads;
+  std::array<uint64_t, 8> ppuWrites;
 
   static std::unordered_set<uint16_t> supportedMappers;
 
@@ -29,16 +42,48 @@ class NesMemory {
   uint8_t programSize;    // multiply by 16KB -> 0x4000 bytes
   uint8_t characterSize;  // multiply by 8KB -> 0x2000 bytes
 
-  enum Nametable : bool { Vertical, Horizontal } mirroring;
+  PPU::Mirroring mirroring;
   bool persistent;
   bool trainerPresent;
 
   uint16_t mapper;
 
  public:
-  NesMemory() = default;
+  // RAM powers on zeroed so runs are reproducible
+  NesMemory()
+      : internalRam(),
+        APUIOMemory(),
+        cpuMemory(),
+        apu(nullptr),
+        scheduler(nullptr),
+        input(nullptr),
+        ppuReads(),
+        ppuWrites() {}
   bool loadRom(const std::string& romPath, PPU& ppu);
+  // An iNES image already in memory, romPath is only used in messages
+  bool loadRom(std::vector<char> data, const std::string& romPath, PPU& ppu);
   inline void setCPU(CPU* inCPU) { cpu = inCPU; }
+  inline void setAPU(APU* inAPU) { apu = inAPU; }
+  // Without a scheduler the PPU is expected to be stepped in lockstep
+  inline void setScheduler(Scheduler* inScheduler) { scheduler = inScheduler; }
+  // Without an input source no buttons are ever pressed
+  inline void setInputSource(InputSource* source) { input = source; }
+  // Polls the input source, called once at the start of every frame
+  inline void latchInput(uint64_t frame) {
+    if (!input) return;
+    PortButtons buttons = input->poll(frame);
+    for (int i = 0; i < NUM_PORTS; ++i) controllers[i].setButtons(buttons[i]);
+  }
+
+  inline const std::array<uint8_t, 0x800>& getRAM() const {
+    return internalRam;
+  }
+  inline const std::array<uint64_t, 8>& getPPUReads() const {
+    return ppuReads;
+  }
+  inline const std::array<uint64_t, 8>& getPPUWrites() const {
+    return ppuWrites;
+  }
 
   uint8_t& operator[](size_t);
   const uint8_t& operator[](size_t) const;
@@ -46,7 +91,18 @@ class NesMemory {
   void write(uint16_t addr, uint8_t val);
   uint8_t read(uint16_t addr);
 
+  // Copies a whole page into OAM if reading it has no side effects
+  bool bulkOAM_DMA(uint8_t page);
+
   void dump();
 
+  // Catches the APU up to the CPU, then updates the IRQ line and the APU's
+  // deadlines
+  void syncAPU();
+
  private:
+  // Brings the PPU up to the current CPU cycle before a register access
+  void syncPPU();
+  // Moves the PPU's deadline after anything that may have changed it
+  void reschedulePPU();
 };
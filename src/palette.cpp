@@ -0,0 +1,230 @@
+#include "palette.h"
+
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PALETTE_X86
+#endif
+
+#include "utils.h"
+
+const std::array<Color, 64> Palette::defaultColors = {
+    {{0x80, 0x80, 0x80}, {0x00, 0x3D, 0xA6}, {0x00, 0x12, 0xB0},
+     {0x44, 0x00, 0x96}, {0xA1, 0x00, 0x5E}, {0xC7, 0x00, 0x28},
+     {0xBA, 0x06, 0x00}, {0x8C, 0x17, 0x00}, {0x5C, 0x2F, 0x00},
+     {0x10, 0x45, 0x00}, {0x05, 0x4A, 0x00}, {0x00, 0x47, 0x2E},
+     {0x00, 0x41, 0x66}, {0x00, 0x00, 0x00}, {0x05, 0x05, 0x05},
+     {0x05, 0x05, 0x05}, {0xC7, 0xC7, 0xC7}, {0x00, 0x77, 0xFF},
+     {0x21, 0x55, 0xFF}, {0x82, 0x37, 0xFA}, {0xEB, 0x2F, 0xB5},
+     {0xFF, 0x29, 0x50}, {0xFF, 0x22, 0x00}, {0xD6, 0x32, 0x00},
+     {0xC4, 0x62, 0x00}, {0x35, 0x80, 0x00}, {0x05, 0x8F, 0x00},
+     {0x00, 0x8A, 0x55}, {0x00, 0x99, 0xCC}, {0x21, 0x21, 0x21},
+     {0x09, 0x09, 0x09}, {0x09, 0x09, 0x09}, {0xFF, 0xFF, 0xFF},
+     {0x0F, 0xD7, 0xFF}, {0x69, 0xA2, 0xFF}, {0xD4, 0x80, 0xFF},
+     {0xFF, 0x45, 0xF3}, {0xFF, 0x61, 0x8B}, {0xFF, 0x88, 0x33},
+     {0xFF, 0x9C, 0x12}, {0xFA, 0xBC, 0x20}, {0x9F, 0xE3, 0x0E},
+     {0x2B, 0xF0, 0x35}, {0x0C, 0xF0, 0xA4}, {0x05, 0xFB, 0xFF},
+     {0x5E, 0x5E, 0x5E}, {0x0D, 0x0D, 0x0D}, {0x0D, 0x0D, 0x0D},
+     {0xFF, 0xFF, 0xFF}, {0xA6, 0xFC, 0xFF}, {0xB3, 0xEC, 0xFF},
+     {0xDA, 0xAB, 0xEB}, {0xFF, 0xA8, 0xF9}, {0xFF, 0xAB, 0xB3},
+     {0xFF, 0xD2, 0xB0}, {0xFF, 0xEF, 0xA6}, {0xFF, 0xF7, 0x9C},
+     {0xD7, 0xE8, 0x95}, {0xA6, 0xED, 0xAF}, {0xA2, 0xF2, 0xDA},
+     {0x99, 0xFF, 0xFC}, {0xDD, 0xDD, 0xDD}, {0x11, 0x11, 0x11},
+     {0x11, 0x11, 0x11}}};
+
+Palette::Palette(uint32_t pixelFormat)
+    : format(SDL_AllocFormat(pixelFormat)), kernel(Kernel::Scalar) {
+  if (format == nullptr) {
+    error(("Pixel format could not be allocated! SDL Error: " +
+           std::string(SDL_GetError()))
+              .c_str());
+    exit(1);
+  }
+
+#ifdef PALETTE_X86
+  if (__builtin_cpu_supports("avx2")) {
+    kernel = Kernel::AVX2;
+  } else if (__builtin_cpu_supports("ssse3")) {
+    kernel = Kernel::SSSE3;
+  }
+#endif
+
+  loadDefault();
+}
+
+Palette::~Palette() { SDL_FreeFormat(format); }
+
+void Palette::loadDefault() {
+  colors[0] = defaultColors;
+  applyEmphasis();
+  build();
+}
+
+bool Palette::load(const std::string& path) {
+  std::ifstream file(path, std::ifstream::binary | std::ifstream::ate);
+  if (file.fail()) {
+    std::cout << "Failed to Open \"" << path << "\"" << std::endl;
+    return false;
+  }
+  std::streamsize size = file.tellg();
+  file.seekg(0, std::ios::beg);
+
+  constexpr std::streamsize BASE_SIZE = NUM_COLORS * 3;
+  constexpr std::streamsize FULL_SIZE = BASE_SIZE * NUM_EMPHASIS;
+  if (size != BASE_SIZE && size != FULL_SIZE) {
+    std::cout << "\"" << path << "\" is not a valid palette, expected "
+              << BASE_SIZE << " or " << FULL_SIZE << " bytes" << std::endl;
+    return false;
+  }
+
+  std::vector<uint8_t> bytes(size);
+  if (!file.read(reinterpret_cast<char*>(bytes.data()), size)) {
+    std::cout << "Failed to Read \"" << path << "\"" << std::endl;
+    return false;
+  }
+
+  for (size_t i = 0; i < static_cast<size_t>(size / 3); ++i) {
+    colors[i / NUM_COLORS][i % NUM_COLORS] = {bytes[i * 3], bytes[i * 3 + 1],
+                                              bytes[i * 3 + 2]};
+  }
+  // Files without emphasis colors get them generated
+  if (size == BASE_SIZE) applyEmphasis();
+
+  build();
+  return true;
+}
+
+// Emphasis darkens the channels that are not emphasized
+void Palette::applyEmphasis() {
+  constexpr uint16_t ATTENUATE = 209;  // ~0.816 in 8.8 fixed point
+
+  for (size_t emphasis = 1; emphasis < NUM_EMPHASIS; ++emphasis) {
+    bool red = emphasis & 0x01;
+    bool green = emphasis & 0x02;
+    bool blue = emphasis & 0x04;
+    for (size_t i = 0; i < NUM_COLORS; ++i) {
+      Color c = colors[0][i];
+      if (green || blue) c.r = (c.r * ATTENUATE) >> 8;
+      if (red || blue) c.g = (c.g * ATTENUATE) >> 8;
+      if (red || green) c.b = (c.b * ATTENUATE) >> 8;
+      colors[emphasis][i] = c;
+    }
+  }
+}
+
+void Palette::build() {
+  for (size_t greyscale = 0; greyscale < 2; ++greyscale) {
+    for (size_t emphasis = 0; emphasis < NUM_EMPHASIS; ++emphasis) {
+      for (size_t i = 0; i < NUM_COLORS; ++i) {
+        // Greyscale only keeps the luminance column
+        const Color& c = colors[emphasis][greyscale ? (i & 0x30) : i];
+        lut[(greyscale << 9) | (emphasis << 6) | i] =
+            SDL_MapRGBA(format, c.r, c.g, c.b, 0xFF);
+      }
+    }
+  }
+
+  for (size_t t = 0; t < lutPlanes.size(); ++t) {
+    for (size_t i = 0; i < NUM_COLORS; ++i) {
+      uint8_t bytes[4];
+      memcpy(bytes, &lut[t * NUM_COLORS + i], sizeof(bytes));
+      for (size_t plane = 0; plane < 4; ++plane) {
+        lutPlanes[t][plane * NUM_COLORS + i] = bytes[plane];
+      }
+    }
+  }
+}
+
+static void convertLineScalar(const uint8_t* src, const uint32_t* table,
+                              uint32_t* dst) {
+  for (size_t x = 0; x < NESWIDTH; ++x) {
+    dst[x] = table[src[x] & 0x3F];
+  }
+}
+
+#ifdef PALETTE_X86
+// 8 pixels per gather straight from the 64 entry table
+__attribute__((target("avx2"))) static void convertLineAVX2(
+    const uint8_t* src, const uint32_t* table, uint32_t* dst) {
+  const __m256i colorMask = _mm256_set1_epi32(0x3F);
+  for (size_t x = 0; x < NESWIDTH; x += 8) {
+    __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + x));
+    __m256i index = _mm256_and_si256(_mm256_cvtepu8_epi32(bytes), colorMask);
+    __m256i pixels = _mm256_i32gather_epi32(
+        reinterpret_cast<const int*>(table), index, sizeof(uint32_t));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x), pixels);
+  }
+}
+
+// 16 pixels at a time. Each byte of the output pixel is looked up from its own
+// plane, the low nibble of the color picks within a 16 byte row and the high
+// bits pick the row.
+__attribute__((target("ssse3"))) static void convertLineSSSE3(
+    const uint8_t* src, const uint8_t* planes, uint32_t* dst) {
+  const __m128i lowMask = _mm_set1_epi8(0x0F);
+  const __m128i highMask = _mm_set1_epi8(0x03);
+
+  for (size_t x = 0; x < NESWIDTH; x += 16) {
+    __m128i index = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+    __m128i low = _mm_and_si128(index, lowMask);
+    __m128i high = _mm_and_si128(_mm_srli_epi16(index, 4), highMask);
+    __m128i row1 = _mm_cmpeq_epi8(high, _mm_set1_epi8(1));
+    __m128i row2 = _mm_cmpeq_epi8(high, _mm_set1_epi8(2));
+    __m128i row3 = _mm_cmpeq_epi8(high, _mm_set1_epi8(3));
+
+    __m128i bytes[4];
+    for (size_t plane = 0; plane < 4; ++plane) {
+      const __m128i* rows =
+          reinterpret_cast<const __m128i*>(planes + plane * 64);
+      __m128i result = _mm_shuffle_epi8(_mm_loadu_si128(rows), low);
+      __m128i r1 = _mm_shuffle_epi8(_mm_loadu_si128(rows + 1), low);
+      __m128i r2 = _mm_shuffle_epi8(_mm_loadu_si128(rows + 2), low);
+      __m128i r3 = _mm_shuffle_epi8(_mm_loadu_si128(rows + 3), low);
+      result = _mm_or_si128(_mm_andnot_si128(row1, result),
+                            _mm_and_si128(row1, r1));
+      result = _mm_or_si128(_mm_andnot_si128(row2, result),
+                            _mm_and_si128(row2, r2));
+      result = _mm_or_si128(_mm_andnot_si128(row3, result),
+                            _mm_and_si128(row3, r3));
+      bytes[plane] = result;
+    }
+
+    // Interleave the planes back into 32 bit pixels
+    __m128i low01 = _mm_unpacklo_epi8(bytes[0], bytes[1]);
+    __m128i high01 = _mm_unpackhi_epi8(bytes[0], bytes[1]);
+    __m128i low23 = _mm_unpacklo_epi8(bytes[2], bytes[3]);
+    __m128i high23 = _mm_unpackhi_epi8(bytes[2], bytes[3]);
+    __m128i* out = reinterpret_cast<__m128i*>(dst + x);
+    _mm_storeu_si128(out, _mm_unpacklo_epi16(low01, low23));
+    _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(low01, low23));
+    _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(high01, high23));
+    _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(high01, high23));
+  }
+}
+#endif
+
+void Palette::convert(const Frame& f, void* dst, int pitch) const {
+  for (size_t y = 0; y < NESHEIGHT; ++y) {
+    const uint8_t* src = f.pixels.data() + y * NESWIDTH;
+    uint32_t* row = reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(dst) +
+                                                y * static_cast<size_t>(pitch));
+    uint8_t mask = f.masks[y];
+    switch (kernel) {
+#ifdef PALETTE_X86
+      case Kernel::AVX2:
+        convertLineAVX2(src, table(mask), row);
+        break;
+      case Kernel::SSSE3:
+        convertLineSSSE3(src, lutPlanes[(table(mask) - lut.data()) / 64].data(),
+                         row);
+        break;
+#endif
+      default:
+        convertLineScalar(src, table(mask), row);
+        break;
+    }
+  }
+}
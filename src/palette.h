@@ -0,0 +1,65 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+#include "frame.h"
+
+struct Color {
+  uint8_t r;
+  uint8_t g;
+  uint8_t b;
+};
+
+// Converts NES colors into the window's native pixel format ahead of time.
+// Every emphasis and greyscale combination of PPUMASK gets its own 64 entry
+// table so producing a pixel is a single load.
+class Palette {
+ private:
+  static constexpr size_t NUM_COLORS = 64;
+  static constexpr size_t NUM_EMPHASIS = 8;
+
+  SDL_PixelFormat* format;
+
+  // Source colors, one set per emphasis combination
+  std::array<std::array<Color, NUM_COLORS>, NUM_EMPHASIS> colors;
+
+  // Indexed by (greyscale << 9) | (emphasis << 6) | color
+  std::array<uint32_t, NUM_COLORS * NUM_EMPHASIS * 2> lut;
+
+  // lut split into the 4 bytes of each pixel, for byte shuffles
+  std::array<std::array<uint8_t, NUM_COLORS * 4>, NUM_EMPHASIS * 2> lutPlanes;
+
+  enum class Kernel { Scalar, SSSE3, AVX2 } kernel;
+
+  static const std::array<Color, NUM_COLORS> defaultColors;
+
+ public:
+  Palette(uint32_t pixelFormat);
+  ~Palette();
+
+  Palette(const Palette&) = delete;
+  Palette& operator=(const Palette&) = delete;
+
+  // Accepts 64 color .pal files, or 512 color files that include emphasis
+  bool load(const std::string& path);
+  void loadDefault();
+
+  // 64 entry table for the greyscale and emphasis bits of a PPUMASK value
+  inline const uint32_t* table(uint8_t mask) const {
+    return lut.data() + (((mask & 0x01) << 9) | ((mask & 0xE0) << 1));
+  }
+  inline uint32_t lookup(uint8_t mask, uint8_t color) const {
+    return table(mask)[color & 0x3F];
+  }
+
+  // Writes native pixels for a whole frame, pitch is in bytes
+  void convert(const Frame& f, void* dst, int pitch) const;
+
+ private:
+  void applyEmphasis();
+  void build();
+};
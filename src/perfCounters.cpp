@@ -0,0 +1,115 @@
+#include "perfCounters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+namespace {
+
+struct EventConfig {
+  uint32_t type;
+  uint64_t config;
+};
+
+constexpr uint64_t cacheMisses(uint64_t cache) {
+  return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+constexpr std::array<EventConfig, PerfCounters::NUM_EVENTS> CONFIGS = {{
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HW_CACHE, cacheMisses(PERF_COUNT_HW_CACHE_L1D)},
+    {PERF_TYPE_HW_CACHE, cacheMisses(PERF_COUNT_HW_CACHE_LL)},
+}};
+
+int openEvent(const EventConfig& event) {
+  perf_event_attr attr{};
+  attr.size = sizeof(attr);
+  attr.type = event.type;
+  attr.config = event.config;
+  attr.disabled = 1;
+  // Only the emulator itself, which is also all an unprivileged user may see
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format =
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+// Reset only clears the count, not the times, so runs are measured as the
+// difference from a reading at their start
+bool readEvent(int fd, void* reading, size_t size) {
+  return fd >= 0 && read(fd, reading, size) == static_cast<ssize_t>(size);
+}
+
+}  // namespace
+
+PerfCounters::PerfCounters() : started() {
+  for (int i = 0; i < NUM_EVENTS; ++i) {
+    fds[i] = openEvent(CONFIGS[i]);
+    if (fds[i] < 0 && unavailable.empty()) {
+      unavailable = std::string(NAMES[i]) + ": " + std::strerror(errno);
+    }
+  }
+}
+
+PerfCounters::~PerfCounters() {
+  for (int fd : fds) {
+    if (fd >= 0) close(fd);
+  }
+}
+
+void PerfCounters::start() {
+  for (int i = 0; i < NUM_EVENTS; ++i) {
+    if (!readEvent(fds[i], &started[i], sizeof(Reading))) continue;
+    ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+  }
+}
+
+PerfCounters::Counts PerfCounters::stop() {
+  for (int fd : fds) {
+    if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+  }
+  Counts counts{};
+  for (int i = 0; i < NUM_EVENTS; ++i) {
+    Reading reading;
+    if (!readEvent(fds[i], &reading, sizeof(reading))) continue;
+    uint64_t enabled = reading.timeEnabled - started[i].timeEnabled;
+    uint64_t running = reading.timeRunning - started[i].timeRunning;
+    counts[i] = static_cast<double>(reading.value - started[i].value);
+    // Scaled up for the share of the run the kernel had it multiplexed out
+    if (running > 0 && running < enabled) {
+      counts[i] *= static_cast<double>(enabled) / static_cast<double>(running);
+    }
+  }
+  return counts;
+}
+
+#else
+
+PerfCounters::PerfCounters()
+    : started(), unavailable("not supported on this platform") {
+  fds.fill(-1);
+}
+
+PerfCounters::~PerfCounters() {}
+
+void PerfCounters::start() {}
+
+PerfCounters::Counts PerfCounters::stop() { return {}; }
+
+#endif
+
+bool PerfCounters::any() const {
+  for (int fd : fds) {
+    if (fd >= 0) return true;
+  }
+  return false;
+}
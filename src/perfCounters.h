@@ -0,0 +1,54 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+// Host hardware counters around a stretch of code, read through
+// perf_event_open. Each event is opened on its own so a CPU or VM missing one
+// still gives the rest. Without permission, in most containers, or off Linux
+// there are simply none and everything here is a no-op.
+class PerfCounters {
+ public:
+  enum Event {
+    CYCLES,
+    INSTRUCTIONS,
+    BRANCH_MISSES,
+    L1D_MISSES,
+    LLC_MISSES,
+    NUM_EVENTS,
+  };
+  static constexpr std::array<const char*, NUM_EVENTS> NAMES = {
+      "cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses"};
+
+  using Counts = std::array<double, NUM_EVENTS>;
+
+ private:
+  // What read() gives with the read format used, the times only advance
+  // while the event is enabled
+  struct Reading {
+    uint64_t value;
+    uint64_t timeEnabled;
+    uint64_t timeRunning;
+  };
+
+  std::array<int, NUM_EVENTS> fds;
+  std::array<Reading, NUM_EVENTS> started;  // At the last start()
+  std::string unavailable;                  // Why the first that failed did
+
+ public:
+  PerfCounters();
+  ~PerfCounters();
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  inline bool has(Event event) const { return fds[event] >= 0; }
+  bool any() const;
+  // Empty if every event opened
+  inline const std::string& getUnavailable() const { return unavailable; }
+
+  void start();
+  // Counts since start, scaled up when the kernel had to multiplex. Events
+  // that aren't there read 0
+  Counts stop();
+};
@@ -2,10 +2,17 @@
 
 #include <SDL2/SDL.h>
 
+#include <algorithm>
 #include <cstring>
 #include <fstream>
 #include <vector>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "deferredRenderer.h"
+#include "trace.h"
 #include "utils.h"
 
 /*
@@ -18,40 +25,203 @@ constexpr int VISIBLE_SCANLINE_DOTS = 256;
 constexpr int NUM_SCANLINE_CYCLES = 341;
 constexpr int SCANLINE_END_CYCLE = 340;
 
+// VBlank and pre-render lines depend on the region
+constexpr int POST_RENDER_SCANLINE = 240;
+
+// Status bits
+constexpr uint8_t STATUS_OVERFLOW = 0x20;
+constexpr uint8_t STATUS_SPRITE_ZERO = 0x40;
+constexpr uint8_t STATUS_VBLANK = 0x80;
+
+// Layout of a spriteLine entry
+constexpr uint8_t SPRITE_PIXEL = 0x03;
+constexpr uint8_t SPRITE_COLOR = 0x0F;  // Pixel and palette
+constexpr uint8_t SPRITE_BEHIND = 0x20;
+constexpr uint8_t SPRITE_ZERO = 0x40;
+
+// Pixel x of a decoded tile row
+static inline uint8_t rowPixel(uint64_t row, int x) {
+  return (row >> (x * 8)) & 0xFF;
+}
+
+constexpr uint64_t BYTES_ONE = 0x0101010101010101;
+
+// 0xFF in every byte holding a non zero 2 bit pixel
+static inline uint64_t opaqueBytes(uint64_t row) {
+  return ((row | (row >> 1)) & BYTES_ONE) * 0xFF;
+}
+
+#ifdef __SSE2__
+// Two background tiles at once, attribute bits only go on opaque pixels
+static inline void storeTiles(uint8_t* dst, uint64_t row0, uint64_t attr0,
+                              uint64_t row1, uint64_t attr1) {
+  __m128i rows = _mm_set_epi64x(row1, row0);
+  __m128i attributes = _mm_set_epi64x(attr1, attr0);
+  __m128i transparent = _mm_cmpeq_epi8(rows, _mm_setzero_si128());
+  __m128i pixels =
+      _mm_or_si128(rows, _mm_andnot_si128(transparent, attributes));
+  _mm_store_si128(reinterpret_cast<__m128i*>(dst), pixels);
+}
+#else
+static inline uint64_t tilePixels(uint64_t row, uint64_t attr) {
+  return row | (opaqueBytes(row) & attr);
+}
+
+static inline void storeTiles(uint8_t* dst, uint64_t row0, uint64_t attr0,
+                              uint64_t row1, uint64_t attr1) {
+  uint64_t pixels[2] = {tilePixels(row0, attr0), tilePixels(row1, attr1)};
+  memcpy(dst, pixels, sizeof(pixels));
+}
+#endif
+
 PPU::PPU(Window* window)
-    : status(0xA0),
+    : VRamInc(1),
+      spritePTAddr(0x0000),
+      backgroundPTAddr(0x0000),
+      spriteSize(false),
+      masterSlaveSel(false),
+      generateNMI(false),
+      maskGreyscale(false),
+      maskShowLeftBackground(false),
+      maskShowLeftSprite(false),
+      maskShowBackground(false),
+      maskShowSprites(false),
+      maskEmphRed(false),
+      maskEmphGreen(false),
+      maskEmphBlue(false),
+      mask(0x00),
+      status(0xA0),
       OAMAddr(0x00),
       data(0x00),
+      latch(0x00),
       rv(0x0000),
       rt(0x0000),
       rx(0x00),
+      writeLatch(false),
+      characterMemory(0x2000),
+      nametableMemory(),
+      paletteMemory(),
+      OAMMemory(),
+      banks(),
+      tileCache(banks.data()),
+      characterSize(0),
       window(window),
       dot(0),
       scanlineState(PPUScanline::PreRender),
-      scanline(0),
-      evenFrame(true) {}
+      scanline(NTSC_TIMING.preRenderScanline),
+      region(Region::NTSC),
+      timing(&NTSC_TIMING),
+      evenFrame(true),
+      nmiPending(false),
+      cycles(0),
+      nmiRaised(false),
+      eventValid(false),
+      nextEvent(0),
+      recorder(nullptr),
+      log(nullptr),
+      renderNextFrame(true),
+      renderCurrentFrame(true),
+      frameCount(0),
+      numLineSprites(0),
+      spriteZeroHitDot(-1),
+      lineSignatures(),
+      versionClock(0),
+      characterVersion(0),
+      paletteVersion(0),
+      oamVersion(0),
+      nametableVersions(),
+      bankSwitches(0) {
+  for (int slot = 0; slot < 8; ++slot) setCharacterBank(slot, slot);
+  setMirroring(Mirroring::Horizontal);
+  rebuildSpriteLines();
+}
 
 void PPU::loadRom(std::vector<char>& inRom, bool trainerPresent) {
+  setRegion(headerRegion(inRom));
   characterSize = inRom[5];
-  mirroring = (inRom[6] & 0x01) ? Horizontal : Vertical;
+  if (inRom[6] & 0x08) {
+    setMirroring(Mirroring::FourScreen);
+  } else {
+    setMirroring((inRom[6] & 0x01) ? Mirroring::Vertical
+                                   : Mirroring::Horizontal);
+  }
   mapper = static_cast<uint8_t>(inRom[6]) >> 4;
   mapper |= static_cast<uint8_t>(inRom[7]) & 0xF0;
   this->rom = &inRom;
+  this->trainerPresent = trainerPresent;
 
   characterStart = 16 + (trainerPresent * 512) + (inRom[4] * 0x4000);
 
-  // TODO fix this
-  if (characterSize > 1) {
-    warning(("Character size " + std::to_string(characterSize * 8) +
-             "KB Not yet supported. Truncating to 8KB")
-                .c_str());
-    characterSize = 1;
+  // No CHR ROM means the cartridge has 8KB of CHR RAM
+  characterMemory.assign(std::max<size_t>(characterSize, 1) * 0x2000, 0);
+  memcpy(characterMemory.data(), inRom.data() + characterStart,
+         characterSize * 0x2000);
+  for (int slot = 0; slot < 8; ++slot) setCharacterBank(slot, slot);
+}
+
+void PPU::setRegion(Region val) {
+  region = val;
+  timing = &regionTiming(region);
+  scanline = timing->preRenderScanline;
+  eventValid = false;
+}
+
+void PPU::display() {
+  std::array<uint8_t, 0x2000> patternTables;
+  for (size_t i = 0; i < patternTables.size(); ++i) {
+    patternTables[i] = vram(i);
   }
+  if (window) window->displayPatternTable(patternTables.data());
+}
 
-  memcpy(memory.data(), inRom.data() + characterStart, characterSize * 0x2000);
+void PPU::setRecorder(DeferredRenderer* renderer) {
+  recorder = renderer;
+  log = nullptr;
+  renderCurrentFrame = renderNextFrame && !recorder;
+  if (recorder) log = recorder->attach(*rom, trainerPresent, renderNextFrame);
+}
+
+void PPU::setMirroring(Mirroring mode) {
+  record(PPUEvent::SetMirroring, 0, static_cast<uint32_t>(mode));
+  // Nametable used for each of $2000, $2400, $2800 and $2C00
+  std::array<int, 4> layout;
+  switch (mode) {
+    case Mirroring::Horizontal:
+      layout = {0, 0, 1, 1};
+      break;
+    case Mirroring::Vertical:
+      layout = {0, 1, 0, 1};
+      break;
+    case Mirroring::SingleScreenLow:
+      layout = {0, 0, 0, 0};
+      break;
+    case Mirroring::SingleScreenHigh:
+      layout = {1, 1, 1, 1};
+      break;
+    case Mirroring::FourScreen:
+      layout = {0, 1, 2, 3};
+      break;
+  }
+  mirroring = mode;
+  for (size_t i = 0; i < layout.size(); ++i) {
+    banks[8 + i] = nametableMemory.data() + layout[i] * BANK_SIZE;
+    banks[12 + i] = banks[8 + i];
+  }
+}
+
+void PPU::setCharacterBank(int slot, size_t bank) {
+  record(PPUEvent::CharacterBank, slot, bank);
+  size_t numBanks = characterMemory.size() / BANK_SIZE;
+  uint8_t* data = characterMemory.data() + (bank % numBanks) * BANK_SIZE;
+  if (banks[slot] && banks[slot] != data) ++bankSwitches;
+  banks[slot] = data;
+  characterVersion = nextVersion();
+  tileCache.invalidateRange(slot * BANK_SIZE, BANK_SIZE);
 }
 
 bool PPU::doCycle() {
+  ++cycles;
+  eventValid = false;
   switch (scanlineState) {
     case PPUScanline::PreRender:
       preRenderStage();
@@ -66,17 +236,47 @@ bool PPU::doCycle() {
       vBlankStage();
       break;
   }
+
+  // Odd frames skip the last dot of the pre-render scanline
+  if (scanlineState == PPUScanline::PreRender &&
+      dot == SCANLINE_END_CYCLE - 1 && !evenFrame && renderingEnabled() &&
+      timing->oddFrameSkip) {
+    ++dot;
+  }
+
   ++dot;
-  // TODO return if send NMI or not
-  return false;
+  if (dot > SCANLINE_END_CYCLE) {
+    dot = 0;
+    ++scanline;
+    if (scanline > timing->preRenderScanline) {
+      scanline = 0;
+      evenFrame = !evenFrame;
+      renderCurrentFrame = renderNextFrame && !recorder;
+    }
+
+    if (scanline < POST_RENDER_SCANLINE) {
+      scanlineState = PPUScanline::Render;
+    } else if (scanline == POST_RENDER_SCANLINE) {
+      scanlineState = PPUScanline::PostRender;
+    } else if (scanline < timing->preRenderScanline) {
+      scanlineState = PPUScanline::VBlank;
+    } else {
+      scanlineState = PPUScanline::PreRender;
+    }
+  }
+
+  bool NMI = nmiPending;
+  nmiPending = false;
+  return NMI;
 }
 
 uint8_t PPU::readctrl() { return latch; }
 uint8_t PPU::readmask() { return latch; }
 
 uint8_t PPU::readstatus() {
+  record(PPUEvent::Read, 2, 0);
   latch = (status & 0b11100000) | (latch & 0b00011111);
-  status = status & 0b01111111;  // clear vblank bit on read
+  status = status & ~STATUS_VBLANK;  // clear vblank bit on read
   writeLatch = false;
   return latch;
 }
@@ -93,10 +293,17 @@ uint8_t PPU::readscroll() { return latch; }
 uint8_t PPU::readaddr() { return latch; }
 
 uint8_t PPU::readdata() {
-  latch = data;
-  uint16_t addr = mapAddr(rv);
-  data = memory[addr];
-  rv += VRamInc;
+  record(PPUEvent::Read, 7, 0);
+  uint16_t addr = rv & 0x3FFF;
+  if (isPalette(addr)) {
+    // Palette reads aren't buffered, the buffer gets the nametable underneath
+    latch = (latch & 0xC0) | paletteMemory[addr & 0x1F];
+    data = vram(addr);
+  } else {
+    latch = data;
+    data = vram(addr);
+  }
+  rv = (rv + VRamInc) & 0x7FFF;
   return latch;
 }
 
@@ -104,7 +311,9 @@ uint8_t PPU::readOAMDMA() { return latch; }
 
 // Writes
 void PPU::writectrl(uint8_t val) {
+  record(PPUEvent::Write, 0, val);
   latch = val;
+  eventValid = false;
   // x... GH.. .... .... <- val: .... ..GH
   rt &= ~0x0C00;
   rt |= (val & 0x03) << 10;
@@ -112,13 +321,21 @@ void PPU::writectrl(uint8_t val) {
   VRamInc = (val & 0x04) ? 32 : 1;
   spritePTAddr = (val & 0x08) ? 0x1000 : 0x0000;
   backgroundPTAddr = (val & 0x10) ? 0x1000 : 0x0000;
+  bool prevSpriteSize = spriteSize;
   spriteSize = (val & 0x20);
+  if (spriteSize != prevSpriteSize) rebuildSpriteLines();
   masterSlaveSel = (val & 0x40);
+
+  // Enabling NMI during VBlank immediately generates one
+  bool prevNMI = generateNMI;
   generateNMI = (val & 0x80);
+  if (!prevNMI && generateNMI && (status & STATUS_VBLANK)) nmiPending = true;
 }
 
 void PPU::writemask(uint8_t val) {
+  record(PPUEvent::Write, 1, val);
   latch = val;
+  eventValid = false;
 
   maskGreyscale = (val & 0x01);
   maskShowLeftBackground = (val & 0x02);
@@ -128,21 +345,52 @@ void PPU::writemask(uint8_t val) {
   maskEmphRed = (val & 0x20);
   maskEmphGreen = (val & 0x40);
   maskEmphBlue = (val & 0x80);
+  mask = val;
 }
 
 void PPU::writestatus(uint8_t val) { latch = val; }
 
 void PPU::writeOAMAddr(uint8_t val) {
+  record(PPUEvent::Write, 3, val);
   latch = val;
   OAMAddr = val;
 }
 
 void PPU::writeOAMData(uint8_t val) {
+  record(PPUEvent::Write, 4, val);
   latch = val;
+  eventValid = false;
+  if (OAMMemory[OAMAddr] != val) oamVersion = nextVersion();
+  if ((OAMAddr & 0x03) == 0 && OAMMemory[OAMAddr] != val) {
+    setSpriteLines(OAMAddr >> 2, OAMMemory[OAMAddr], false);
+    setSpriteLines(OAMAddr >> 2, val, true);
+  }
   OAMMemory[OAMAddr++] = val;
 }
 
+void PPU::writeOAMBlock(const uint8_t* page) {
+  if (log) {
+    record(PPUEvent::OAMBlock, 0, log->blocks.size());
+    log->blocks.insert(log->blocks.end(), page, page + OAMMemory.size());
+  }
+  latch = page[0xFF];
+  eventValid = false;
+
+  // Starts at OAMAddr and wraps, which leaves OAMAddr where it was. Most
+  // games copy the same page every frame
+  size_t first = OAMMemory.size() - OAMAddr;
+  if (memcmp(OAMMemory.data() + OAMAddr, page, first) == 0 &&
+      memcmp(OAMMemory.data(), page + first, OAMAddr) == 0) {
+    return;
+  }
+  memcpy(OAMMemory.data() + OAMAddr, page, first);
+  memcpy(OAMMemory.data(), page + first, OAMAddr);
+  oamVersion = nextVersion();
+  rebuildSpriteLines();
+}
+
 void PPU::writescroll(uint8_t val) {
+  record(PPUEvent::Write, 5, val);
   latch = val;
   if (!writeLatch) {
     rt &= ~0x001F;  // clear bits 4-0 and replace with bits 7-3 of val
@@ -158,6 +406,7 @@ void PPU::writescroll(uint8_t val) {
 }
 
 void PPU::writeaddr(uint8_t val) {
+  record(PPUEvent::Write, 6, val);
   latch = val;
   // High is first
   if (!writeLatch) {
@@ -170,10 +419,24 @@ void PPU::writeaddr(uint8_t val) {
 }
 
 void PPU::writedata(uint8_t val) {
+  record(PPUEvent::Write, 7, val);
   latch = val;
-  uint16_t addr = mapAddr(rv);
-  memory[addr] = val;
-  rv += VRamInc;
+  uint16_t addr = rv & 0x3FFF;
+  if (isPalette(addr)) {
+    // $3F10, $3F14, $3F18 and $3F1C are the same bytes as $3F00-$3F0C
+    uint8_t index = addr & 0x1F;
+    if (paletteMemory[index] != val) paletteVersion = nextVersion();
+    paletteMemory[index] = val;
+    if ((index & 0x03) == 0) paletteMemory[index ^ 0x10] = val;
+  } else if (addr < 0x2000) {
+    vram(addr) = val;
+    tileCache.invalidate(addr);
+    characterVersion = nextVersion();
+  } else {
+    if (vram(addr) != val) touchNametable(addr);
+    vram(addr) = val;
+  }
+  rv = (rv + VRamInc) & 0x7FFF;
 }
 
 void PPU::dump() const {
@@ -185,7 +448,7 @@ void PPU::dump() const {
     uint8_t numZeroes = 0;
     std::string line = "";
     for (size_t i = 0; i < 0x10; ++i) {
-      uint8_t val = memory[pc + i];
+      uint8_t val = readVram(pc + i);
       line += to_hex(val) + " ";
       if (val == 0x00) {
         numZeroes++;
@@ -212,51 +475,461 @@ void PPU::dump() const {
   file << std::flush;
 }
 
-uint16_t PPU::mapAddr(uint16_t addr) {
-  if (addr > 0x4000) {
-    return addr % 0x4000;
+void PPU::touchNametable(uint16_t addr) {
+  std::array<uint32_t, 32>& rows =
+      nametableVersions[physicalNametable((addr >> 10) & 0x03)];
+  uint16_t offset = addr & (BANK_SIZE - 1);
+  uint32_t version = nextVersion();
+  rows[offset >> 5] = version;
+  if (offset >= 0x3C0) {
+    // Each attribute byte covers 4 rows of tiles
+    size_t row = ((offset - 0x3C0) >> 3) * 4;
+    for (size_t i = row; i < std::min<size_t>(row + 4, rows.size()); ++i) {
+      rows[i] = version;
+    }
+  }
+}
+
+PPU::LineSignature PPU::lineSignature() const {
+  int nametable = (rv >> 10) & 0x03;
+  size_t coarseY = (rv >> 5) & 0x1F;
+
+  LineSignature signature;
+  signature.drawn = true;
+  signature.x = rx;
+  signature.v = rv;
+  signature.mask = mask;
+  signature.ctrl = (backgroundPTAddr >> 12) | ((spritePTAddr >> 12) << 1) |
+                   (spriteSize << 2);
+  signature.nametableRows = {
+      nametableVersions[physicalNametable(nametable)][coarseY],
+      nametableVersions[physicalNametable(nametable ^ 0x01)][coarseY]};
+  signature.character = characterVersion;
+  signature.palette = paletteVersion;
+  signature.sprites = spriteLines[scanline];
+  signature.oam = signature.sprites ? oamVersion : 0;
+  return signature;
+}
+
+// Value cycles will have once the doCycle that handles line, lineDot is done
+uint64_t PPU::cyclesUntil(int line, int lineDot) const {
+  int64_t distance =
+      (line - scanline) * NUM_SCANLINE_CYCLES + (lineDot - dot);
+  if (distance < 0) {
+    distance += (timing->preRenderScanline + 1) * NUM_SCANLINE_CYCLES;
+    bool pastSkip =
+        scanline == timing->preRenderScanline && dot == SCANLINE_END_CYCLE;
+    if (timing->oddFrameSkip && !evenFrame && renderingEnabled() &&
+        !pastSkip) {
+      --distance;
+    }
   }
-  // Pattern Tables
-  if (addr < 0x2000) return addr;
+  return cycles + distance + 1;
+}
+
+// Only holds until a register write or the PPU runs, both invalidate it
+uint64_t PPU::predictNextEvent() const {
+  if (nmiPending) return cycles + 1;
+
+  uint64_t next = std::min({cyclesUntil(POST_RENDER_SCANLINE, 0),
+                            cyclesUntil(timing->vblankScanline, 1),
+                            cyclesUntil(timing->preRenderScanline, 1)});
 
-  // Unused portion
-  if (addr < 0x3F00 && addr >= 0x3000) {
-    return addr;
+  if (!maskShowBackground || !maskShowSprites) return next;
+  if (status & STATUS_SPRITE_ZERO) return next;
+
+  // Within a line the hit dot is known once the line has started, otherwise
+  // the next line sprite zero is on is where it gets worked out
+  bool lineStarted = scanline < POST_RENDER_SCANLINE && dot > 1;
+  if (lineStarted && spriteZeroHitDot > dot) {
+    return std::min(next, cyclesUntil(scanline, spriteZeroHitDot));
   }
-  // Palette
-  if (addr >= 0x3F00) {
-    uint16_t temp = addr - 0x3F00;
-    temp %= 0x0020;
-    return temp + 0x3F00;
+  int first = 0;
+  if (scanline < POST_RENDER_SCANLINE) first = scanline + lineStarted;
+  for (int line = first; line < POST_RENDER_SCANLINE; ++line) {
+    if (spriteLines[line] & 0x01) {
+      return std::min(next, cyclesUntil(line, 1));
+    }
   }
+  return next;
+}
 
-  // Nametable
-  int nameTableIndex = (addr - 0x2000) / 0x400;
-  if (mirroring == Horizontal) {
-    if (nameTableIndex == 0 || nameTableIndex == 2) {
-      return addr;
-    }
-    /*
-      2400-27FF -> 2000-23FF
-      2C00-2FFF -> 2800-2BFF
-    */
-    return addr - 0x400;
+uint8_t PPU::readVram(uint16_t addr) const {
+  if (isPalette(addr)) return paletteMemory[addr & 0x1F];
+  return vram(addr);
+}
+
+void PPU::incrementX(uint16_t& v) const {
+  if ((v & 0x001F) == 31) {
+    v &= ~0x001F;
+    v ^= 0x0400;  // Switch horizontal nametable
+  } else {
+    ++v;
+  }
+}
+
+void PPU::incrementY() {
+  if ((rv & 0x7000) != 0x7000) {
+    rv += 0x1000;  // Fine Y
+    return;
+  }
+  rv &= ~0x7000;
+  uint16_t y = (rv & 0x03E0) >> 5;
+  if (y == 29) {
+    y = 0;
+    rv ^= 0x0800;  // Switch vertical nametable
+  } else if (y == 31) {
+    y = 0;  // Attribute table rows wrap without switching nametable
   } else {
-    if (nameTableIndex == 0 || nameTableIndex == 1) {
-      return addr;
+    ++y;
+  }
+  rv = (rv & ~0x03E0) | (y << 5);
+}
+
+// v: ....A.. ...BCDEF <- t: ....A.. ...BCDEF
+void PPU::copyHorizontal() { rv = (rv & ~0x041F) | (rt & 0x041F); }
+
+// v: GHIA.BC DEF..... <- t: GHIA.BC DEF.....
+void PPU::copyVertical() { rv = (rv & ~0x7BE0) | (rt & 0x7BE0); }
+
+// Sprites are drawn on the lines below their Y coordinate
+void PPU::setSpriteLines(int sprite, uint8_t y, bool covered) {
+  int height = spriteSize ? 16 : 8;
+  uint64_t bit = 1ull << sprite;
+  int end = std::min(y + height, static_cast<int>(NESHEIGHT) - 1);
+  for (int line = y + 1; line <= end; ++line) {
+    if (covered) {
+      spriteLines[line] |= bit;
+    } else {
+      spriteLines[line] &= ~bit;
+    }
+  }
+}
+
+// Used when many sprites change at once, tests all 64 Y coordinates per line
+void PPU::rebuildSpriteLines() {
+#ifdef __SSE2__
+  alignas(16) std::array<int16_t, 64> ys;
+  for (size_t i = 0; i < 64; ++i) ys[i] = OAMMemory[i * 4];
+
+  const __m128i height = _mm_set1_epi16(spriteSize ? 16 : 8);
+  const __m128i negative = _mm_set1_epi16(-1);
+  const __m128i* spriteY = reinterpret_cast<const __m128i*>(ys.data());
+  for (size_t line = 0; line < NESHEIGHT; ++line) {
+    // Row of each sprite on this line, covered if in [0, height)
+    const __m128i row = _mm_set1_epi16(line - 1);
+    uint64_t covered = 0;
+    for (size_t group = 0; group < 4; ++group) {
+      __m128i row0 = _mm_sub_epi16(row, _mm_load_si128(spriteY + group * 2));
+      __m128i row1 =
+          _mm_sub_epi16(row, _mm_load_si128(spriteY + group * 2 + 1));
+      __m128i in0 = _mm_and_si128(_mm_cmpgt_epi16(row0, negative),
+                                  _mm_cmplt_epi16(row0, height));
+      __m128i in1 = _mm_and_si128(_mm_cmpgt_epi16(row1, negative),
+                                  _mm_cmplt_epi16(row1, height));
+      uint64_t bits = static_cast<uint16_t>(
+          _mm_movemask_epi8(_mm_packs_epi16(in0, in1)));
+      covered |= bits << (group * 16);
     }
-    /*
-      2800-2BFF -> 2000-23FF
-      2C00-2FFF -> 2400-27FF
-    */
-    return addr - 0x800;
+    spriteLines[line] = covered;
   }
+#else
+  spriteLines.fill(0);
+  for (int i = 0; i < 64; ++i) setSpriteLines(i, OAMMemory[i * 4], true);
+#endif
 }
 
-void PPU::preRenderStage() { uint16_t addr = 0x2000 | (rv & 0x0FFF); }
+void PPU::evaluateSprites() {
+  numLineSprites = 0;
+  if (!renderingEnabled()) return;
+
+  int height = spriteSize ? 16 : 8;
+  uint64_t covered = spriteLines[scanline];
+  if (__builtin_popcountll(covered) > 8) status |= STATUS_OVERFLOW;
+
+  for (; covered && numLineSprites < 8; covered &= covered - 1) {
+    int i = __builtin_ctzll(covered);
+    int row = scanline - 1 - OAMMemory[i * 4];
+
+    uint8_t tile = OAMMemory[i * 4 + 1];
+    uint8_t attributes = OAMMemory[i * 4 + 2];
+    if (attributes & 0x80) row = height - 1 - row;  // Vertical flip
+
+    uint16_t tileAddr;
+    if (spriteSize) {
+      // 8x16 sprites select the pattern table with bit 0 of the tile
+      tileAddr = ((tile & 0x01) ? 0x100 : 0x000) + (tile & 0xFE);
+      if (row >= 8) {
+        ++tileAddr;
+        row -= 8;
+      }
+    } else {
+      tileAddr = (spritePTAddr >> 4) + tile;
+    }
+
+    Sprite& sprite = lineSprites[numLineSprites++];
+    sprite.x = OAMMemory[i * 4 + 3];
+    sprite.attributes = attributes;
+    sprite.pattern = tileCache.row(tileAddr, row);
+    sprite.spriteZero = (i == 0);
+    if (attributes & 0x40) {  // Horizontal flip
+      sprite.pattern = TileCache::flip(sprite.pattern);
+    }
+  }
+}
+
+// Background palette index at screen position x of the current scanline
+uint8_t PPU::backgroundPixel(int x) {
+  int position = x + rx;
+  uint16_t v = rv;
+  uint16_t coarseX = (v & 0x001F) + position / 8;
+  if (coarseX >= 32) {
+    coarseX -= 32;
+    v ^= 0x0400;
+  }
+  v = (v & ~0x001F) | coarseX;
 
-void PPU::renderStage() {}
+  uint8_t tileIndex = nametable(v);
+  uint64_t row =
+      tileCache.row((backgroundPTAddr >> 4) + tileIndex, (v >> 12) & 0x07);
+  return rowPixel(row, position % 8);
+}
+
+// Frame skipping still needs sprite zero hit, so only sprite zero's pixels
+// are checked against the background
+void PPU::checkSpriteZero() {
+  if (!maskShowBackground || !maskShowSprites) return;
+  if (numLineSprites == 0 || !lineSprites[0].spriteZero) return;
+  if (status & STATUS_SPRITE_ZERO) return;
+
+  const Sprite& sprite = lineSprites[0];
+  for (int bit = 0; bit < 8; ++bit) {
+    int x = sprite.x + bit;
+    if (x >= 255) break;  // Never hits on the last pixel
+    if (x < 8 && (!maskShowLeftBackground || !maskShowLeftSprite)) continue;
+    if (!rowPixel(sprite.pattern, bit)) continue;
+    if (backgroundPixel(x)) {
+      spriteZeroHitDot = x + 1;
+      return;
+    }
+  }
+}
+
+void PPU::renderScanline() {
+  TRACE_SCOPE("PPU scanline");
+  evaluateSprites();
+  spriteZeroHitDot = -1;
+
+  if (!renderCurrentFrame) {
+    checkSpriteZero();
+    return;
+  }
+
+  // Unchanged lines keep the pixels already in frame
+  LineSignature signature = lineSignature();
+  if (signature == lineSignatures[scanline]) {
+    ++renderStats.linesReused;
+    checkSpriteZero();
+    return;
+  }
+  lineSignatures[scanline] = signature;
+  ++renderStats.linesDrawn;
+
+  renderBackground();
+
+  renderSprites();
+  multiplex();
+}
+
+// Sprite pixels for the line, lower OAM index has priority
+void PPU::renderSprites() {
+  spriteLine.fill(0);
+  if (!maskShowSprites) return;
+
+  for (int i = 0; i < numLineSprites; ++i) {
+    const Sprite& sprite = lineSprites[i];
+    uint64_t attributes = ((sprite.attributes & 0x03) << 2) |
+                          ((sprite.attributes & 0x20) ? SPRITE_BEHIND : 0) |
+                          (sprite.spriteZero ? SPRITE_ZERO : 0);
+
+    // Only fill in pixels no earlier sprite has covered
+    uint64_t current;
+    memcpy(&current, &spriteLine[sprite.x], sizeof(current));
+    uint64_t write = opaqueBytes(sprite.pattern) &
+                     ~opaqueBytes(current & (SPRITE_PIXEL * BYTES_ONE));
+    current = (current & ~write) |
+              ((sprite.pattern | (attributes * BYTES_ONE)) & write);
+    memcpy(&spriteLine[sprite.x], &current, sizeof(current));
+  }
+
+  if (!maskShowLeftSprite) memset(spriteLine.data(), 0, 8);
+}
 
-void PPU::postRenderStage() {}
+// Picks background or sprite for every pixel, then the palette color
+void PPU::multiplex() {
+  frame.setMask(scanline, mask);
 
-void PPU::vBlankStage() {}
+  std::array<uint8_t, 0x20> paletteRam;
+  for (size_t i = 0; i < paletteRam.size(); ++i) {
+    paletteRam[i] = paletteMemory[i] & 0x3F;
+  }
+
+  alignas(16) std::array<uint8_t, NESWIDTH> colors;
+  bool checkHit = spriteZeroHitDot < 0 && !(status & STATUS_SPRITE_ZERO);
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi8(-1);
+  const __m128i pixelMask = _mm_set1_epi8(SPRITE_PIXEL);
+  const __m128i colorMask = _mm_set1_epi8(SPRITE_COLOR);
+  const __m128i behindMask = _mm_set1_epi8(SPRITE_BEHIND);
+  const __m128i zeroMask = _mm_set1_epi8(SPRITE_ZERO);
+  const __m128i spritePalette = _mm_set1_epi8(0x10);
+  for (size_t x = 0; x < NESWIDTH; x += 16) {
+    __m128i bg = _mm_load_si128(reinterpret_cast<const __m128i*>(&bgLine[x]));
+    __m128i sp =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(&spriteLine[x]));
+
+    __m128i bgOpaque = _mm_xor_si128(_mm_cmpeq_epi8(bg, zero), ones);
+    __m128i spOpaque =
+        _mm_xor_si128(_mm_cmpeq_epi8(_mm_and_si128(sp, pixelMask), zero), ones);
+    __m128i spBehind =
+        _mm_cmpeq_epi8(_mm_and_si128(sp, behindMask), behindMask);
+
+    // Sprite wins when opaque, unless it is behind an opaque background
+    __m128i useSprite =
+        _mm_andnot_si128(_mm_and_si128(spBehind, bgOpaque), spOpaque);
+    __m128i spColor = _mm_or_si128(_mm_and_si128(sp, colorMask), spritePalette);
+    __m128i index = _mm_or_si128(_mm_and_si128(useSprite, spColor),
+                                 _mm_andnot_si128(useSprite, bg));
+    _mm_store_si128(reinterpret_cast<__m128i*>(&colors[x]), index);
+
+    if (checkHit) {
+      __m128i spZero = _mm_cmpeq_epi8(_mm_and_si128(sp, zeroMask), zeroMask);
+      __m128i hit = _mm_and_si128(_mm_and_si128(spOpaque, spZero), bgOpaque);
+      int hits = _mm_movemask_epi8(hit);
+      if (x == NESWIDTH - 16) hits &= 0x7FFF;  // Never hits on the last pixel
+      if (hits) {
+        spriteZeroHitDot = x + __builtin_ctz(hits) + 1;
+        checkHit = false;
+      }
+    }
+  }
+#else
+  for (size_t x = 0; x < NESWIDTH; ++x) {
+    uint8_t bg = bgLine[x];
+    uint8_t sp = spriteLine[x];
+    bool spOpaque = sp & SPRITE_PIXEL;
+
+    if (checkHit && bg && spOpaque && (sp & SPRITE_ZERO) && x != 255) {
+      spriteZeroHitDot = x + 1;
+      checkHit = false;
+    }
+
+    if (spOpaque && (!bg || !(sp & SPRITE_BEHIND))) {
+      colors[x] = 0x10 | (sp & SPRITE_COLOR);
+    } else {
+      colors[x] = bg;
+    }
+  }
+#endif
+
+  uint8_t* pixels = frame.pixels.data() + scanline * NESWIDTH;
+  for (size_t x = 0; x < NESWIDTH; ++x) pixels[x] = paletteRam[colors[x]];
+}
+
+// Decoded row for the tile at v, attribute gets the tile's palette bits in
+// every byte
+uint64_t PPU::fetchBackgroundRow(uint16_t v, uint64_t& attribute) {
+  uint8_t tileIndex = nametable(v);
+  uint16_t attributeAddr =
+      0x03C0 | (v & 0x0C00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07);
+  uint8_t attributeByte = nametable(attributeAddr);
+  // Each attribute byte covers 4x4 tiles, select the 2x2 quadrant
+  uint8_t paletteBits =
+      ((attributeByte >> (((v >> 4) & 0x04) | (v & 0x02))) & 0x03) << 2;
+  attribute = paletteBits * BYTES_ONE;
+
+  return tileCache.row((backgroundPTAddr >> 4) + tileIndex, (v >> 12) & 0x07);
+}
+
+// Produces bgLine 8 pixels per tile, fine x scrolling is an offset into the
+// tiles and the left column mask is a blend with zero
+void PPU::renderBackground() {
+  if (!maskShowBackground) {
+    bgLine.fill(0);
+    return;
+  }
+
+  uint16_t v = rv;
+  for (size_t tile = 0; tile < 34; tile += 2) {
+    uint64_t attr0, attr1;
+    uint64_t row0 = fetchBackgroundRow(v, attr0);
+    incrementX(v);
+    uint64_t row1 = fetchBackgroundRow(v, attr1);
+    incrementX(v);
+    storeTiles(bgTiles.data() + tile * 8, row0, attr0, row1, attr1);
+  }
+
+#ifdef __SSE2__
+  for (size_t x = 0; x < NESWIDTH; x += 16) {
+    __m128i pixels =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(&bgTiles[x + rx]));
+    _mm_store_si128(reinterpret_cast<__m128i*>(&bgLine[x]), pixels);
+  }
+  if (!maskShowLeftBackground) {
+    __m128i leftMask = _mm_set_epi64x(-1, 0);
+    __m128i* first = reinterpret_cast<__m128i*>(bgLine.data());
+    _mm_store_si128(first, _mm_and_si128(_mm_load_si128(first), leftMask));
+  }
+#else
+  memcpy(bgLine.data(), bgTiles.data() + rx, NESWIDTH);
+  if (!maskShowLeftBackground) memset(bgLine.data(), 0, 8);
+#endif
+}
+
+void PPU::preRenderStage() {
+  if (dot == 1) {
+    status &= ~(STATUS_VBLANK | STATUS_SPRITE_ZERO | STATUS_OVERFLOW);
+  }
+  if (!renderingEnabled()) return;
+
+  if (dot == VISIBLE_SCANLINE_DOTS) {
+    incrementY();
+  } else if (dot == VISIBLE_SCANLINE_DOTS + 1) {
+    copyHorizontal();
+  } else if (dot >= 280 && dot <= 304) {
+    copyVertical();
+  }
+}
+
+// Whole scanline is produced on the first dot, sprite zero hit is delayed
+// until the dot it would occur on
+void PPU::renderStage() {
+  if (dot == 1) renderScanline();
+  if (dot == spriteZeroHitDot) status |= STATUS_SPRITE_ZERO;
+  if (!renderingEnabled()) return;
+
+  if (dot == VISIBLE_SCANLINE_DOTS) {
+    incrementY();
+  } else if (dot == VISIBLE_SCANLINE_DOTS + 1) {
+    copyHorizontal();
+  }
+}
+
+void PPU::postRenderStage() {
+  if (dot != 0) return;
+  if (recorder) {
+    log = recorder->submit(cycles);
+  } else if (renderCurrentFrame) {
+    frame.number = frameCount;
+    if (window) window->submitFrame(frame);
+  }
+  ++frameCount;
+}
+
+void PPU::vBlankStage() {
+  if (scanline == timing->vblankScanline && dot == 1) {
+    status |= STATUS_VBLANK;
+    if (generateNMI) nmiPending = true;
+  }
+}
@@ -4,15 +4,30 @@
 #include <cstdint>
 #include <vector>
 
+#include "ppuLog.h"
+#include "region.h"
+#include "tileCache.h"
 #include "window.h"
 
-struct Color {
-  uint8_t r;
-  uint8_t g;
-  uint8_t b;
-};
+class DeferredRenderer;
 
 class PPU {
+ public:
+  enum class Mirroring {
+    Horizontal,  // $2000 = $2400, $2800 = $2C00
+    Vertical,    // $2000 = $2800, $2400 = $2C00
+    SingleScreenLow,
+    SingleScreenHigh,
+    FourScreen,  // Cartridge provides the other 2KB
+  };
+
+  static constexpr size_t BANK_SIZE = 0x400;
+
+  struct RenderStats {
+    uint64_t linesDrawn = 0;
+    uint64_t linesReused = 0;  // Identical to the last time they were drawn
+  };
+
  private:
   // MMIO Registers
 
@@ -33,6 +48,7 @@ class PPU {
   bool maskEmphRed;
   bool maskEmphGreen;
   bool maskEmphBlue;
+  uint8_t mask;  // Greyscale and emphasis are applied per scanline
 
   uint8_t status;   // Read only
   uint8_t OAMAddr;  // Write only
@@ -48,39 +64,24 @@ class PPU {
   bool writeLatch;
 
   // Memory
-  std::array<uint8_t, 0x4000> memory;
+  std::vector<uint8_t> characterMemory;  // All of CHR ROM, or 8KB of CHR RAM
+  std::array<uint8_t, 4 * BANK_SIZE> nametableMemory;  // 2KB, 4KB four screen
+  std::array<uint8_t, 0x20> paletteMemory;  // Mirrors kept equal on write
   std::array<uint8_t, 256> OAMMemory;
 
-  std::array<Color, 64> palette = {
-      {{0x80, 0x80, 0x80}, {0x00, 0x3D, 0xA6}, {0x00, 0x12, 0xB0},
-       {0x44, 0x00, 0x96}, {0xA1, 0x00, 0x5E}, {0xC7, 0x00, 0x28},
-       {0xBA, 0x06, 0x00}, {0x8C, 0x17, 0x00}, {0x5C, 0x2F, 0x00},
-       {0x10, 0x45, 0x00}, {0x05, 0x4A, 0x00}, {0x00, 0x47, 0x2E},
-       {0x00, 0x41, 0x66}, {0x00, 0x00, 0x00}, {0x05, 0x05, 0x05},
-       {0x05, 0x05, 0x05}, {0xC7, 0xC7, 0xC7}, {0x00, 0x77, 0xFF},
-       {0x21, 0x55, 0xFF}, {0x82, 0x37, 0xFA}, {0xEB, 0x2F, 0xB5},
-       {0xFF, 0x29, 0x50}, {0xFF, 0x22, 0x00}, {0xD6, 0x32, 0x00},
-       {0xC4, 0x62, 0x00}, {0x35, 0x80, 0x00}, {0x05, 0x8F, 0x00},
-       {0x00, 0x8A, 0x55}, {0x00, 0x99, 0xCC}, {0x21, 0x21, 0x21},
-       {0x09, 0x09, 0x09}, {0x09, 0x09, 0x09}, {0xFF, 0xFF, 0xFF},
-       {0x0F, 0xD7, 0xFF}, {0x69, 0xA2, 0xFF}, {0xD4, 0x80, 0xFF},
-       {0xFF, 0x45, 0xF3}, {0xFF, 0x61, 0x8B}, {0xFF, 0x88, 0x33},
-       {0xFF, 0x9C, 0x12}, {0xFA, 0xBC, 0x20}, {0x9F, 0xE3, 0x0E},
-       {0x2B, 0xF0, 0x35}, {0x0C, 0xF0, 0xA4}, {0x05, 0xFB, 0xFF},
-       {0x5E, 0x5E, 0x5E}, {0x0D, 0x0D, 0x0D}, {0x0D, 0x0D, 0x0D},
-       {0xFF, 0xFF, 0xFF}, {0xA6, 0xFC, 0xFF}, {0xB3, 0xEC, 0xFF},
-       {0xDA, 0xAB, 0xEB}, {0xFF, 0xA8, 0xF9}, {0xFF, 0xAB, 0xB3},
-       {0xFF, 0xD2, 0xB0}, {0xFF, 0xEF, 0xA6}, {0xFF, 0xF7, 0x9C},
-       {0xD7, 0xE8, 0x95}, {0xA6, 0xED, 0xAF}, {0xA2, 0xF2, 0xDA},
-       {0x99, 0xFF, 0xFC}, {0xDD, 0xDD, 0xDD}, {0x11, 0x11, 0x11},
-       {0x11, 0x11, 0x11}}};
+  // One 1KB bank per 0x400 of address space, 0-7 pattern tables, 8-11
+  // nametables and 12-15 their mirror at $3000. Mappers swap pointers
+  std::array<uint8_t*, 16> banks;
+
+  TileCache tileCache;
 
   // Header information
   uint8_t characterSize;  // multiply by 8KB -> 0x2000 bytes
-  enum Nametable : bool { Vertical, Horizontal } mirroring;
+  Mirroring mirroring;
   uint16_t mapper;
 
   std::vector<char>* rom;
+  bool trainerPresent;
   size_t characterStart;
 
   // SDL Window wrapper
@@ -96,26 +97,145 @@ class PPU {
   } scanlineState;
   int scanline;
 
+  Region region;
+  const RegionTiming* timing;
+
   bool evenFrame;
-  bool vBlank;
-  bool spriteZeroHit;
+  bool nmiPending;
+  uint64_t cycles;  // Since power on
+
+  // Event driven stepping
+  bool nmiRaised;  // By a catch up, until taken
+  bool eventValid;
+  uint64_t nextEvent;
+
+  // Deferred rendering, when set this PPU only keeps timing and records into
+  // log, recorder draws the frames
+  DeferredRenderer* recorder;
+  PPULog* log;
+
+  // Frame skipping, renderNextFrame is latched at the start of each frame so a
+  // frame is never half drawn
+  bool renderNextFrame;
+  bool renderCurrentFrame;
+  uint64_t frameCount;
+
+  Frame frame;
 
   // Internal to rendering
-  std::array<uint8_t, 2> bgShiftLow;
-  std::array<uint8_t, 2> bgShiftHigh;
+  struct Sprite {
+    uint8_t x;
+    uint8_t attributes;
+    uint64_t pattern;  // Decoded row, already flipped
+    bool spriteZero;
+  };
+  std::array<Sprite, 8> lineSprites;
+  int numLineSprites;
+
+  // Bit n is set if sprite n covers the scanline. Kept up to date as OAM is
+  // written so evaluation never has to scan all 64 sprites
+  std::array<uint64_t, NESHEIGHT> spriteLines;
+  int spriteZeroHitDot;  // Dot sprite zero hits on the current line, -1 if none
+
+  // Background pixels for 34 tiles so fine x scrolling can start mid tile,
+  // tiles are produced in pairs
+  alignas(16) std::array<uint8_t, 34 * 8> bgTiles;
+  alignas(16) std::array<uint8_t, NESWIDTH> bgLine;
+  std::array<uint8_t, NESWIDTH + 8> spriteLine;  // Padded for 8 byte writes
+
+  // Everything a scanline's pixels depend on. Memory is tracked by version
+  // stamps taken from versionClock when it changes, so a line whose signature
+  // matches the one it was last drawn with can keep its pixels
+  struct LineSignature {
+    bool drawn;
+    uint8_t x;
+    uint16_t v;
+    uint8_t mask;
+    uint8_t ctrl;  // Pattern tables and sprite size
+    std::array<uint32_t, 2> nametableRows;  // Both nametables the line crosses
+    uint32_t character;
+    uint32_t palette;
+    uint32_t oam;  // 0 when no sprites are on the line
+    uint64_t sprites;
 
-  std::array<uint8_t, 8> spriteShiftLow;
-  std::array<uint8_t, 8> spriteShiftHigh;
-  std::array<uint8_t, 8> spriteAttributeShift;
+    bool operator==(const LineSignature&) const = default;
+  };
+  std::array<LineSignature, NESHEIGHT> lineSignatures;
+
+  uint32_t versionClock;
+  uint32_t characterVersion;
+  uint32_t paletteVersion;
+  uint32_t oamVersion;
+  // Per physical nametable and coarse row, attribute writes stamp every row
+  // they cover
+  std::array<std::array<uint32_t, 32>, 4> nametableVersions;
+
+  RenderStats renderStats;
+  uint64_t bankSwitches;  // Pattern table banks actually changed by a mapper
 
  public:
+  // window may be nullptr to run headless, frames are still rendered
   PPU(Window* window);
 
   void loadRom(std::vector<char>& inRom, bool trainerPresent);
 
+  // Only before the PPU has run, loadRom sets it from the header
+  void setRegion(Region val);
+  inline Region getRegion() const { return region; }
+  inline const RegionTiming& getTiming() const { return *timing; }
+
   bool doCycle();
 
-  inline void display() { window->displayPatternTable(memory.data()); }
+  // When disabled frames still run all timing, NMI, sprite zero hit and sprite
+  // overflow, but no pixels are produced or presented. Takes effect on the
+  // next frame
+  inline void setRenderFrame(bool val) {
+    record(PPUEvent::RenderFrame, 0, val);
+    renderNextFrame = val;
+  }
+  inline bool getRenderFrame() const { return renderNextFrame; }
+  inline uint64_t getFrameCount() const { return frameCount; }
+  inline const Frame& getFrame() const { return frame; }
+  inline const RenderStats& getRenderStats() const { return renderStats; }
+  inline const TileCache& getTileCache() const { return tileCache; }
+  inline uint64_t getBankSwitches() const { return bankSwitches; }
+
+  // Hands rendering to renderer, must be done before the PPU has run. nullptr
+  // draws here again
+  void setRecorder(DeferredRenderer* renderer);
+  inline uint64_t getCycles() const { return cycles; }
+  inline void runUntil(uint64_t cycle) {
+    while (cycles < cycle) doCycle();
+  }
+
+  // Event driven stepping. The PPU only has to be run when a register is
+  // accessed, which must catch it up first, or once nextEventCycle() is
+  // reached. NMI raised while catching up is held until taken
+  inline void catchUp(uint64_t cycle) {
+    while (cycles < cycle) nmiRaised |= doCycle();
+  }
+  inline bool takeNMI() {
+    bool NMI = nmiRaised;
+    nmiRaised = false;
+    return NMI;
+  }
+  // Cycle count by which the PPU must be caught up for VBlank, NMI, sprite
+  // zero hit, status clears and the end of the frame to land on time
+  inline uint64_t nextEventCycle() {
+    if (!eventValid) {
+      nextEvent = predictNextEvent();
+      eventValid = true;
+    }
+    return nextEvent;
+  }
+
+  void display();
+
+  // Mapper interface
+  void setMirroring(Mirroring mode);
+  inline Mirroring getMirroring() const { return mirroring; }
+  // Points slot (0-7, 1KB each of $0000-$1FFF) at 1KB bank of CHR
+  void setCharacterBank(int slot, size_t bank);
 
   // Memory Mapped IO
   uint8_t readctrl();
@@ -133,6 +253,7 @@ class PPU {
   void writestatus(uint8_t val);
   void writeOAMAddr(uint8_t val);
   void writeOAMData(uint8_t val);
+  void writeOAMBlock(const uint8_t* page);  // 256 bytes, same as OAM DMA
   void writescroll(uint8_t val);
   void writeaddr(uint8_t val);
   void writedata(uint8_t val);
@@ -140,7 +261,55 @@ class PPU {
   void dump() const;
 
  private:
-  uint16_t mapAddr(uint16_t addr);
+  inline void record(PPUEvent::Type type, uint8_t reg, uint32_t value) {
+    if (log) log->events.push_back({cycles, value, type, reg});
+  }
+
+  inline uint32_t nextVersion() { return ++versionClock; }
+  // Physical nametable behind logical nametable 0-3
+  inline size_t physicalNametable(int index) const {
+    return (banks[8 | index] - nametableMemory.data()) / BANK_SIZE;
+  }
+  void touchNametable(uint16_t addr);
+  LineSignature lineSignature() const;
+
+  uint64_t cyclesUntil(int line, int lineDot) const;
+  uint64_t predictNextEvent() const;
+
+  inline uint8_t& vram(uint16_t addr) {
+    return banks[(addr >> 10) & 0x0F][addr & (BANK_SIZE - 1)];
+  }
+  inline uint8_t vram(uint16_t addr) const {
+    return banks[(addr >> 10) & 0x0F][addr & (BANK_SIZE - 1)];
+  }
+  // Nametable byte for the low 12 bits of v
+  inline uint8_t nametable(uint16_t v) const {
+    return banks[8 | ((v >> 10) & 0x03)][v & (BANK_SIZE - 1)];
+  }
+  static inline bool isPalette(uint16_t addr) {
+    return (addr & 0x3F00) == 0x3F00;
+  }
+  uint8_t readVram(uint16_t addr) const;
+
+  inline bool renderingEnabled() const {
+    return maskShowBackground || maskShowSprites;
+  }
+
+  void incrementX(uint16_t& v) const;
+  void incrementY();
+  void copyHorizontal();
+  void copyVertical();
+
+  void setSpriteLines(int sprite, uint8_t y, bool covered);
+  void rebuildSpriteLines();
+  void evaluateSprites();
+  void renderSprites();
+  void multiplex();
+  void renderScanline();
+  void renderBackground();
+  uint64_t fetchBackgroundRow(uint16_t v, uint64_t& attribute);
+  void checkSpriteZero();
+  uint8_t backgroundPixel(int x);
 
   void preRenderStage();
   void renderStage();
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Something the CPU did to the PPU that affects rendering, stamped with the
+// PPU cycle it happened on so another PPU can replay it exactly
+struct PPUEvent {
+  enum Type : uint8_t {
+    Read,           // reg is the register, only $2002 and $2007 have effects
+    Write,          // reg is the register, value the byte written
+    OAMBlock,       // value is the offset of the page in PPULog::blocks
+    CharacterBank,  // reg is the slot, value the bank
+    SetMirroring,   // value is the PPU::Mirroring
+    RenderFrame,    // value is the setRenderFrame argument
+  };
+
+  uint64_t cycle;  // PPU cycles completed before the event
+  uint32_t value;
+  Type type;
+  uint8_t reg;
+};
+
+// Everything recorded over one frame
+struct PPULog {
+  std::vector<PPUEvent> events;
+  std::vector<uint8_t> blocks;  // OAM DMA pages, 256 bytes each
+  uint64_t endCycle = 0;        // Cycle the frame was finished on
+
+  inline void clear() {
+    events.clear();
+    blocks.clear();
+  }
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+enum class Region : uint8_t { NTSC, PAL, Dendy };
+
+// Everything that differs between regions. The CPU and PPU clocks are whole
+// divisions of the master clock so timing never needs floating point
+struct RegionTiming {
+  Region region;
+  const char* name;
+  uint64_t masterClock;  // Hz
+  uint64_t cpuDivider;
+  uint64_t ppuDivider;
+  int vblankScanline;     // VBlank flag and NMI are set on dot 1
+  int preRenderScanline;  // Last line of the frame
+  bool oddFrameSkip;      // Odd frames skip the last pre-render dot
+};
+
+inline constexpr RegionTiming NTSC_TIMING = {
+    Region::NTSC, "NTSC", 21477272, 12, 4, 241, 261, true};
+inline constexpr RegionTiming PAL_TIMING = {
+    Region::PAL, "PAL", 26601712, 16, 5, 241, 311, false};
+inline constexpr RegionTiming DENDY_TIMING = {
+    Region::Dendy, "Dendy", 26601712, 15, 5, 291, 311, false};
+
+inline const RegionTiming& regionTiming(Region region) {
+  switch (region) {
+    case Region::PAL:
+      return PAL_TIMING;
+    case Region::Dendy:
+      return DENDY_TIMING;
+    default:
+      return NTSC_TIMING;
+  }
+}
+
+// NES 2.0 byte 12 or iNES byte 9, multi region carts run as NTSC
+inline Region headerRegion(const std::vector<char>& rom) {
+  bool nes2 = (rom[7] & 0x0C) == 0x08;
+  if (nes2) {
+    switch (rom[12] & 0x03) {
+      case 1:
+        return Region::PAL;
+      case 3:
+        return Region::Dendy;
+      default:
+        return Region::NTSC;
+    }
+  }
+  return (rom[9] & 0x01) ? Region::PAL : Region::NTSC;
+}
+
+// Length of a frame in nanoseconds, NTSC averages the skipped dot
+inline uint64_t framePeriod(const RegionTiming& timing) {
+  uint64_t halfDots = (timing.preRenderScanline + 1) * 341 * 2;
+  if (timing.oddFrameSkip) --halfDots;
+  return halfDots * timing.ppuDivider * 1000000000 / (timing.masterClock * 2);
+}
@@ -0,0 +1,39 @@
+#include "scheduler.h"
+
+#include <algorithm>
+
+Scheduler::Scheduler(uint64_t cpuBase, const RegionTiming& timing)
+    : deadlines(),
+      handlers(),
+      next(NEVER),
+      cpuBase(cpuBase),
+      cpuDeadline(NEVER),
+      cpuDivider(timing.cpuDivider),
+      ppuDivider(timing.ppuDivider) {
+  deadlines.fill(NEVER);
+}
+
+void Scheduler::schedule(Source source, uint64_t time) {
+  deadlines[source] = time;
+  update();
+}
+
+void Scheduler::dispatch(uint64_t now) {
+  while (next <= now) {
+    size_t source =
+        std::min_element(deadlines.begin(), deadlines.end()) -
+        deadlines.begin();
+    deadlines[source] = NEVER;
+    update();
+    handlers[source](now);
+  }
+}
+
+void Scheduler::update() {
+  next = *std::min_element(deadlines.begin(), deadlines.end());
+  if (next == NEVER) {
+    cpuDeadline = NEVER;
+  } else {
+    cpuDeadline = cpuBase + (next + cpuDivider - 1) / cpuDivider;
+  }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <limits>
+
+#include "region.h"
+
+// Deadlines on the master clock for everything that needs the CPU to stop.
+// Each source has a single slot, the CPU runs until the earliest one and then
+// dispatch() calls the handlers that are due, which reschedule themselves.
+class Scheduler {
+ public:
+  enum Source : uint8_t {
+    PPU_EVENT,  // NMI, VBlank, sprite zero hit, end of frame
+    APU_FRAME_COUNTER,
+    DMC,
+    MAPPER_IRQ,
+    NUM_SOURCES,
+  };
+
+  static constexpr uint64_t NEVER = std::numeric_limits<uint64_t>::max();
+
+  using Handler = std::function<void(uint64_t now)>;
+
+ private:
+  std::array<uint64_t, NUM_SOURCES> deadlines;
+  std::array<Handler, NUM_SOURCES> handlers;
+
+  uint64_t next;
+  uint64_t cpuBase;      // CPU cycle counter at master clock 0
+  uint64_t cpuDeadline;  // next as a CPU cycle counter
+
+  uint64_t cpuDivider;
+  uint64_t ppuDivider;
+
+ public:
+  Scheduler(uint64_t cpuBase, const RegionTiming& timing);
+
+  inline void setHandler(Source source, Handler handler) {
+    handlers[source] = std::move(handler);
+  }
+
+  // Replaces any deadline the source already had
+  void schedule(Source source, uint64_t time);
+  inline void cancel(Source source) { schedule(source, NEVER); }
+  // Deadline as a CPU cycle counter
+  inline void scheduleCycle(Source source, uint64_t cycle) {
+    schedule(source, cycle == NEVER ? NEVER : cpuTime(cycle));
+  }
+
+  inline uint64_t nextDeadline() const { return next; }
+  // First CPU cycle that starts on or after the next deadline
+  inline uint64_t getCPUDeadline() const { return cpuDeadline; }
+
+  // Master clock at the start of a CPU cycle
+  inline uint64_t cpuTime(uint64_t cycle) const {
+    return (cycle - cpuBase) * cpuDivider;
+  }
+  // PPU cycles completed by time, PAL's 3.2 PPU cycles per CPU cycle just
+  // rounds down
+  inline uint64_t ppuCycles(uint64_t time) const { return time / ppuDivider; }
+  inline uint64_t ppuTime(uint64_t cycles) const {
+    return cycles * ppuDivider;
+  }
+
+  // Calls the handler of every source due by now, earliest first
+  void dispatch(uint64_t now);
+
+ private:
+  void update();
+};
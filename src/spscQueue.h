@@ -0,0 +1,62 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Bounded lock free queue for exactly one producer and one consumer thread
+template <typename T, size_t N>
+class SPSCQueue {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "Size must be a power of 2");
+
+ private:
+  std::array<T, N> items;
+  alignas(64) std::atomic<size_t> head;  // Next item to pop
+  alignas(64) std::atomic<size_t> tail;  // Next slot to push
+
+ public:
+  SPSCQueue() : items(), head(0), tail(0) {}
+
+  // Returns false if the queue is full
+  inline bool push(const T& item) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) == N) return false;
+    items[t & (N - 1)] = item;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Returns false if the queue is empty
+  inline bool pop(T& item) {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire)) return false;
+    item = items[h & (N - 1)];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Bulk versions, return how many items were actually moved
+  inline size_t push(const T* source, size_t count) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    count = std::min(count, N - (t - head.load(std::memory_order_acquire)));
+    for (size_t i = 0; i < count; ++i) items[(t + i) & (N - 1)] = source[i];
+    tail.store(t + count, std::memory_order_release);
+    return count;
+  }
+
+  inline size_t pop(T* destination, size_t count) {
+    size_t h = head.load(std::memory_order_relaxed);
+    count = std::min(count, tail.load(std::memory_order_acquire) - h);
+    for (size_t i = 0; i < count; ++i) {
+      destination[i] = items[(h + i) & (N - 1)];
+    }
+    head.store(h + count, std::memory_order_release);
+    return count;
+  }
+
+  inline size_t size() const {
+    return tail.load(std::memory_order_acquire) -
+           head.load(std::memory_order_acquire);
+  }
+};
@@ -0,0 +1,145 @@
+#include "stats.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+#include "cpu.h"
+#include "nesMemory.h"
+#include "ppu.h"
+
+namespace {
+
+constexpr std::array<const char*, 8> REGISTER_NAMES = {
+    "PPUCTRL", "PPUMASK",   "PPUSTATUS", "OAMADDR",
+    "OAMDATA", "PPUSCROLL", "PPUADDR",   "PPUDATA"};
+
+double ratio(double part, double whole) {
+  return whole > 0 ? part / whole : 0;
+}
+
+void metric(std::ostream& out, const char* name, const char* type,
+            const char* help) {
+  out << "# HELP " << name << " " << help << "\n"
+      << "# TYPE " << name << " " << type << "\n";
+}
+
+}  // namespace
+
+double Stats::speed() const { return ratio(emulatedSeconds, wallSeconds); }
+
+double Stats::lineReuseRate() const {
+  return ratio(linesReused, linesDrawn + linesReused);
+}
+
+double Stats::tileHitRate() const {
+  return ratio(tileLookups - tileDecodes, tileLookups);
+}
+
+DrawStats drawStats(const PPU& ppu) {
+  DrawStats draw;
+  draw.linesDrawn = ppu.getRenderStats().linesDrawn;
+  draw.linesReused = ppu.getRenderStats().linesReused;
+  draw.tileLookups = ppu.getTileCache().getLookups();
+  draw.tileDecodes = ppu.getTileCache().getDecodes();
+  return draw;
+}
+
+Stats collectStats(const CPU& cpu, const PPU& ppu, const NesMemory& memory,
+                   const DrawStats& draw, double wallSeconds) {
+  const RegionTiming& timing = ppu.getTiming();
+  Stats stats;
+  stats.cpuCycles = cpu.getCycle();
+  stats.instructions = cpu.getInstructions();
+  stats.frames = ppu.getFrameCount();
+  stats.ppuReads = memory.getPPUReads();
+  stats.ppuWrites = memory.getPPUWrites();
+  stats.bankSwitches = ppu.getBankSwitches();
+  stats.dmaCycles = cpu.getDMACycles();
+  stats.linesDrawn = draw.linesDrawn;
+  stats.linesReused = draw.linesReused;
+  stats.tileLookups = draw.tileLookups;
+  stats.tileDecodes = draw.tileDecodes;
+  stats.emulatedSeconds = static_cast<double>(stats.cpuCycles) *
+                          timing.cpuDivider / timing.masterClock;
+  stats.wallSeconds = wallSeconds;
+  return stats;
+}
+
+void printStats(std::ostream& out, const Stats& stats, const Stats& previous) {
+  double speed = ratio(stats.emulatedSeconds - previous.emulatedSeconds,
+                       stats.wallSeconds - previous.wallSeconds);
+  out << "[" << stats.wallSeconds << "s] frames: " << stats.frames
+      << ", instructions: " << stats.instructions << ", speed: " << speed
+      << "x, lines reused: " << stats.lineReuseRate() * 100
+      << "%, tile hits: " << stats.tileHitRate() * 100 << "%" << std::endl;
+}
+
+void writePrometheus(std::ostream& out, const Stats& stats) {
+  metric(out, "nes_cpu_cycles_total", "counter", "Emulated CPU cycles.");
+  out << "nes_cpu_cycles_total " << stats.cpuCycles << "\n";
+  metric(out, "nes_instructions_total", "counter",
+         "Emulated 6502 instructions.");
+  out << "nes_instructions_total " << stats.instructions << "\n";
+  metric(out, "nes_frames_total", "counter", "Emulated frames.");
+  out << "nes_frames_total " << stats.frames << "\n";
+
+  metric(out, "nes_ppu_register_accesses_total", "counter",
+         "CPU accesses to the PPU registers.");
+  for (size_t i = 0; i < REGISTER_NAMES.size(); ++i) {
+    out << "nes_ppu_register_accesses_total{register=\"" << REGISTER_NAMES[i]
+        << "\",access=\"read\"} " << stats.ppuReads[i] << "\n"
+        << "nes_ppu_register_accesses_total{register=\"" << REGISTER_NAMES[i]
+        << "\",access=\"write\"} " << stats.ppuWrites[i] << "\n";
+  }
+
+  metric(out, "nes_bank_switches_total", "counter",
+         "Pattern table banks changed by the mapper.");
+  out << "nes_bank_switches_total " << stats.bankSwitches << "\n";
+  metric(out, "nes_dma_cycles_total", "counter",
+         "CPU cycles spent halted for OAM and DMC DMA.");
+  out << "nes_dma_cycles_total " << stats.dmaCycles << "\n";
+
+  metric(out, "nes_scanlines_total", "counter",
+         "Visible scanlines, reused ones were unchanged and not drawn.");
+  out << "nes_scanlines_total{result=\"drawn\"} " << stats.linesDrawn << "\n"
+      << "nes_scanlines_total{result=\"reused\"} " << stats.linesReused
+      << "\n";
+  metric(out, "nes_tile_cache_lookups_total", "counter",
+         "Decoded tile row lookups, misses had to decode the tile.");
+  out << "nes_tile_cache_lookups_total{result=\"hit\"} "
+      << stats.tileLookups - stats.tileDecodes << "\n"
+      << "nes_tile_cache_lookups_total{result=\"miss\"} " << stats.tileDecodes
+      << "\n";
+
+  metric(out, "nes_emulated_seconds_total", "counter",
+         "Console time emulated.");
+  out << "nes_emulated_seconds_total " << stats.emulatedSeconds << "\n";
+  metric(out, "nes_wall_seconds_total", "counter",
+         "Host time spent emulating.");
+  out << "nes_wall_seconds_total " << stats.wallSeconds << "\n";
+  metric(out, "nes_speed_ratio", "gauge",
+         "Emulated time over host time since start, 1 is realtime.");
+  out << "nes_speed_ratio " << stats.speed() << "\n";
+}
+
+bool writePrometheus(const std::string& path, const Stats& stats) {
+  std::string temporary = path + ".tmp";
+  {
+    std::ofstream file(temporary, std::ofstream::trunc);
+    if (file.fail()) {
+      std::cout << "Failed to Open \"" << temporary << "\"" << std::endl;
+      return false;
+    }
+    writePrometheus(file, stats);
+    if (!file.flush()) {
+      std::cout << "Failed to Write \"" << temporary << "\"" << std::endl;
+      return false;
+    }
+  }
+  if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+    std::cout << "Failed to Write \"" << path << "\"" << std::endl;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+class CPU;
+class NesMemory;
+class PPU;
+
+// Counters of the PPU that actually draws, which is the deferred renderer's
+// shadow when there is one
+struct DrawStats {
+  uint64_t linesDrawn = 0;
+  uint64_t linesReused = 0;
+  uint64_t tileLookups = 0;
+  uint64_t tileDecodes = 0;
+};
+
+// A snapshot of the core's running counters. Every counter is a plain
+// increment where the work already happens, so taking one is cheap enough to
+// do every frame.
+struct Stats {
+  uint64_t cpuCycles = 0;
+  uint64_t instructions = 0;
+  uint64_t frames = 0;
+  std::array<uint64_t, 8> ppuReads{};  // By register, $2000-$2007
+  std::array<uint64_t, 8> ppuWrites{};
+  uint64_t bankSwitches = 0;
+  uint64_t dmaCycles = 0;  // CPU cycles lost to OAM and DMC DMA
+  uint64_t linesDrawn = 0;
+  uint64_t linesReused = 0;
+  uint64_t tileLookups = 0;
+  uint64_t tileDecodes = 0;
+  double emulatedSeconds = 0;  // CPU cycles at the region's clock
+  double wallSeconds = 0;
+
+  // Emulated time over wall time, 1 is realtime
+  double speed() const;
+  double lineReuseRate() const;
+  double tileHitRate() const;
+};
+
+DrawStats drawStats(const PPU& ppu);
+
+Stats collectStats(const CPU& cpu, const PPU& ppu, const NesMemory& memory,
+                   const DrawStats& draw, double wallSeconds);
+
+// One line, speed is over the time since previous
+void printStats(std::ostream& out, const Stats& stats, const Stats& previous);
+
+// Prometheus text exposition format
+void writePrometheus(std::ostream& out, const Stats& stats);
+// Replaces path whole, so a node exporter textfile collector never reads a
+// partly written file
+bool writePrometheus(const std::string& path, const Stats& stats);
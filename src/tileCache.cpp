@@ -0,0 +1,36 @@
+#include "tileCache.h"
+
+// Each bit of a byte moved to the bottom of its own byte, bit 7 -> byte 0
+static constexpr std::array<uint64_t, 256> makeSpread() {
+  std::array<uint64_t, 256> table{};
+  for (size_t b = 0; b < 256; ++b) {
+    for (size_t bit = 0; bit < 8; ++bit) {
+      table[b] |= static_cast<uint64_t>((b >> (7 - bit)) & 0x01) << (bit * 8);
+    }
+  }
+  return table;
+}
+
+const std::array<uint64_t, 256> TileCache::spread = makeSpread();
+
+TileCache::TileCache(uint8_t* const* banks)
+    : lookups(0), decodes(0), banks(banks) {
+  invalidateAll();
+}
+
+void TileCache::invalidateRange(uint16_t addr, size_t size) {
+  for (size_t tile = addr >> 4; tile < ((addr + size + 15) >> 4); ++tile) {
+    dirty[tile % NUM_TILES] = true;
+  }
+}
+
+void TileCache::invalidateAll() { dirty.fill(true); }
+
+void TileCache::decode(uint16_t tile) {
+  const uint8_t* pattern = banks[tile >> 6] + (tile & 0x3F) * 16;
+  for (size_t y = 0; y < 8; ++y) {
+    rows[tile][y] = spread[pattern[y]] | (spread[pattern[y + 8]] << 1);
+  }
+  dirty[tile] = false;
+  ++decodes;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Pattern table tiles decoded ahead of time. Each 8 pixel row is packed into a
+// uint64_t with one 2 bit pixel per byte, leftmost pixel in the lowest byte,
+// so a row can be composited 8 pixels at a time. Tiles are decoded lazily the
+// first time they are used after their pattern bytes change.
+class TileCache {
+ public:
+  static constexpr size_t NUM_TILES = 512;  // Both pattern tables
+
+ private:
+  std::array<std::array<uint64_t, 8>, NUM_TILES> rows;
+  std::array<bool, NUM_TILES> dirty;
+  uint64_t lookups;
+  uint64_t decodes;  // Lookups that missed
+
+  // The PPU's 1KB pattern table banks, 64 tiles each
+  uint8_t* const* banks;
+
+  static const std::array<uint64_t, 256> spread;
+
+ public:
+  TileCache(uint8_t* const* banks);
+
+  // addr is a pattern table address, 0x0000-0x1FFF
+  inline void invalidate(uint16_t addr) {
+    dirty[(addr >> 4) % NUM_TILES] = true;
+  }
+  void invalidateRange(uint16_t addr, size_t size);
+  void invalidateAll();
+
+  // tile includes the pattern table, 0x100 and above is the right table
+  inline uint64_t row(uint16_t tile, int y) {
+    ++lookups;
+    if (dirty[tile]) decode(tile);
+    return rows[tile][y];
+  }
+
+  inline uint64_t getLookups() const { return lookups; }
+  inline uint64_t getDecodes() const { return decodes; }
+
+  // Pixels reversed for horizontally flipped sprites
+  static inline uint64_t flip(uint64_t row) { return __builtin_bswap64(row); }
+
+ private:
+  void decode(uint16_t tile);
+};
@@ -0,0 +1,152 @@
+#include "trace.h"
+
+#ifdef NES_TRACE
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace trace {
+
+namespace {
+
+constexpr size_t RING_SIZE = 1 << 17;  // Events per thread, 3MB
+
+// A frame boundary is an event with no name, end holds the frame number
+struct Event {
+  const char* name;
+  uint64_t begin;
+  uint64_t end;
+};
+
+struct Ring {
+  std::array<Event, RING_SIZE> events;
+  uint64_t count = 0;  // Ever recorded, only the last RING_SIZE are kept
+  const char* threadName = nullptr;
+  int id;
+};
+
+// Rings outlive their threads so a thread that has finished still shows up
+struct Registry {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<Ring>> rings;
+  // Ticks are turned into time against the clock over the whole recording
+  uint64_t startTicks = ticks();
+  std::chrono::steady_clock::time_point startTime =
+      std::chrono::steady_clock::now();
+};
+
+Registry& registry() {
+  static Registry instance;
+  return instance;
+}
+
+thread_local Ring* threadRing = nullptr;
+
+Ring& ring() {
+  if (threadRing) return *threadRing;
+  Registry& shared = registry();
+  std::lock_guard<std::mutex> lock(shared.mutex);
+  shared.rings.push_back(std::make_unique<Ring>());
+  threadRing = shared.rings.back().get();
+  threadRing->id = static_cast<int>(shared.rings.size());
+  return *threadRing;
+}
+
+void push(const Event& event) {
+  Ring& local = ring();
+  local.events[local.count % RING_SIZE] = event;
+  ++local.count;
+}
+
+// JSON strings here are only ever the literals passed to the macros
+void writeName(std::ostream& out, const char* name) {
+  out << '"';
+  for (const char* c = name; *c; ++c) {
+    if (*c == '"' || *c == '\\') out << '\\';
+    out << *c;
+  }
+  out << '"';
+}
+
+}  // namespace
+
+void record(const char* name, uint64_t begin, uint64_t end) {
+  push({name, begin, end});
+}
+
+void markFrame(uint64_t frame) { push({nullptr, ticks(), frame}); }
+
+void nameThread(const char* name) { ring().threadName = name; }
+
+bool writeChromeTrace(const std::string& path) {
+  std::ofstream file(path);
+  if (file.fail()) {
+    std::cout << "Failed to Open \"" << path << "\"" << std::endl;
+    return false;
+  }
+
+  Registry& shared = registry();
+  std::lock_guard<std::mutex> lock(shared.mutex);
+  std::chrono::duration<double, std::micro> elapsed =
+      std::chrono::steady_clock::now() - shared.startTime;
+  double ticksPerMicrosecond =
+      (ticks() - shared.startTicks) / std::max(elapsed.count(), 1.0);
+  auto micros = [&](uint64_t tick) {
+    return (static_cast<double>(tick) - shared.startTicks) /
+           ticksPerMicrosecond;
+  };
+
+  file << std::fixed << std::setprecision(3) << "{\"traceEvents\": [\n";
+  bool first = true;
+  auto next = [&]() -> std::ostream& {
+    file << (first ? "  " : ",\n  ");
+    first = false;
+    return file;
+  };
+
+  for (const std::unique_ptr<Ring>& ring : shared.rings) {
+    if (ring->threadName) {
+      next() << "{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, "
+             << "\"tid\": " << ring->id << ", \"args\": {\"name\": ";
+      writeName(file, ring->threadName);
+      file << "}}";
+    }
+
+    // Each frame becomes a slice from its boundary to the next, so the
+    // subsystems' slices sit under the frame they ran in
+    const Event* frameStart = nullptr;
+    uint64_t begin = ring->count > RING_SIZE ? ring->count - RING_SIZE : 0;
+    for (uint64_t i = begin; i < ring->count; ++i) {
+      const Event& event = ring->events[i % RING_SIZE];
+      if (event.name) {
+        next() << "{\"ph\": \"X\", \"name\": ";
+        writeName(file, event.name);
+        file << ", \"pid\": 1, \"tid\": " << ring->id
+             << ", \"ts\": " << micros(event.begin)
+             << ", \"dur\": " << micros(event.end) - micros(event.begin)
+             << "}";
+        continue;
+      }
+      if (frameStart) {
+        next() << "{\"ph\": \"X\", \"name\": \"Frame "
+               << frameStart->end << "\", \"pid\": 1, \"tid\": " << ring->id
+               << ", \"ts\": " << micros(frameStart->begin)
+               << ", \"dur\": "
+               << micros(event.begin) - micros(frameStart->begin) << "}";
+      }
+      frameStart = &event;
+    }
+  }
+  file << "\n]}\n";
+  return true;
+}
+
+}  // namespace trace
+
+#endif
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "utils.h"
+
+// Scoped timers for a per frame breakdown of where the time goes, exported as
+// Chrome trace event JSON (chrome://tracing or ui.perfetto.dev). Only built
+// with -Dtrace=true, which defines NES_TRACE, otherwise every macro here is
+// empty.
+//
+// Each thread records into its own ring, so recording takes no lock and never
+// allocates after a thread's first event. The oldest events are overwritten
+// once a ring is full.
+//
+//   TRACE_THREAD("Emulation");  // Names the calling thread in the trace
+//   TRACE_SCOPE("CPU");         // Times until the end of the enclosing block
+//   TRACE_FRAME(frame);         // Frame boundaries, one thread should mark
+
+#ifdef NES_TRACE
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+namespace trace {
+
+inline uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+void record(const char* name, uint64_t begin, uint64_t end);
+void markFrame(uint64_t frame);
+void nameThread(const char* name);
+// Must only be called once no other thread is recording
+bool writeChromeTrace(const std::string& path);
+
+class Scope {
+ private:
+  const char* name;
+  uint64_t begin;
+
+ public:
+  explicit Scope(const char* name) : name(name), begin(ticks()) {}
+  ~Scope() { record(name, begin, ticks()); }
+  Scope(const Scope&) = delete;
+  Scope& operator=(const Scope&) = delete;
+};
+
+}  // namespace trace
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) \
+  trace::Scope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_FRAME(frame) trace::markFrame(frame)
+#define TRACE_THREAD(name) trace::nameThread(name)
+
+#else
+
+namespace trace {
+
+inline bool writeChromeTrace(const std::string&) {
+  warning("Built without tracing, configure with -Dtrace=true");
+  return false;
+}
+
+}  // namespace trace
+
+#define TRACE_SCOPE(name) static_cast<void>(0)
+#define TRACE_FRAME(frame) static_cast<void>(0)
+#define TRACE_THREAD(name) static_cast<void>(0)
+
+#endif
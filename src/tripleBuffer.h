@@ -0,0 +1,37 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Lock free handoff of whole buffers from one producer to one consumer. The
+// producer always has a buffer to write into and the consumer always sees the
+// most recently published one, neither ever waits on the other.
+template <typename T>
+class TripleBuffer {
+ private:
+  static constexpr uint8_t INDEX = 0x03;
+  static constexpr uint8_t FRESH = 0x04;  // Middle has not been consumed yet
+
+  std::array<T, 3> buffers;
+  std::atomic<uint8_t> middle;
+  uint8_t back;   // Owned by the producer
+  uint8_t front;  // Owned by the consumer
+
+ public:
+  TripleBuffer() : buffers(), middle(1), back(0), front(2) {}
+
+  // Producer
+  inline T& getBack() { return buffers[back]; }
+  inline void publish() {
+    back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX;
+  }
+
+  // Consumer, returns true if front now holds a newly published buffer
+  inline bool update() {
+    if (!(middle.load(std::memory_order_relaxed) & FRESH)) return false;
+    front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+    return true;
+  }
+  inline const T& getFront() const { return buffers[front]; }
+};
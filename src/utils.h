@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
 #include <iomanip>
 #include <ios>
@@ -53,6 +55,14 @@ inline bool is_in(First&& first, T&&... t) {
   return ((first == t) || ...);
 }
 
+// FNV-1a, pass the previous result to continue a hash over more data
+inline uint64_t fnv1a(const void* data, size_t size,
+                      uint64_t hash = 1469598103934665603ull) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; ++i) hash = (hash ^ bytes[i]) * 1099511628211ull;
+  return hash;
+}
+
 template <typename T>
 std::string to_hex(T i) {
   std::stringstream ss;
@@ -1,5 +1,6 @@
 #include "window.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <vector>
 
@@ -9,14 +10,22 @@
 #include "SDL_stdinc.h"
 #include "SDL_surface.h"
 #include "SDL_video.h"
+#include "trace.h"
 #include "utils.h"
 
-Window::Window()
+// Native texture format the palette converts into
+constexpr uint32_t TEXTURE_FORMAT = SDL_PIXELFORMAT_ARGB8888;
+
+Window::Window(bool vsync, Scaling scaling)
     : screenWidth(NESWIDTH),
       screenHeight(NESHEIGHT),
       window(nullptr),
       renderer(nullptr),
-      screen(nullptr) {
+      texture(nullptr),
+      scaling(scaling),
+      currentFrame(0),
+      buttons(0),
+      open(true) {
   if (SDL_Init(SDL_INIT_VIDEO) < 0) {
     error(("SDL could not initalize! SDL Error: " + std::string(SDL_GetError()))
               .c_str());
@@ -24,69 +33,191 @@ Window::Window()
 
   window = SDL_CreateWindow("NES Emulator", SDL_WINDOWPOS_UNDEFINED,
                             SDL_WINDOWPOS_UNDEFINED, screenWidth, screenHeight,
-                            SDL_WINDOW_SHOWN);
+                            SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
   if (window == nullptr) {
     error(("Window could not be created! SDL_Error: " +
            std::string(SDL_GetError()))
               .c_str());
   }
 
-  renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+  uint32_t rendererFlags = SDL_RENDERER_ACCELERATED;
+  if (vsync) rendererFlags |= SDL_RENDERER_PRESENTVSYNC;
+  renderer = SDL_CreateRenderer(window, -1, rendererFlags);
   if (renderer == nullptr) {
     error(("Renderer could not be created! SDL_Error: " +
            std::string(SDL_GetError()))
               .c_str());
   }
 
-  screen = SDL_GetWindowSurface(window);
+  texture = SDL_CreateTexture(renderer, TEXTURE_FORMAT,
+                              SDL_TEXTUREACCESS_STREAMING, NESWIDTH, NESHEIGHT);
+  if (texture == nullptr) {
+    error(("Texture could not be created! SDL_Error: " +
+           std::string(SDL_GetError()))
+              .c_str());
+  }
 
-  SDL_FillRect(screen, NULL,
-               SDL_MapRGBA(screen->format, 0xDD, 0x00, 0x30, 0xFF));
+  palette = std::make_unique<Palette>(TEXTURE_FORMAT);
 
-  SDL_UpdateWindowSurface(window);
+  SDL_SetRenderDrawColor(renderer, 0xDD, 0x00, 0x30, 0xFF);
+  SDL_RenderClear(renderer);
+  SDL_RenderPresent(renderer);
+  SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0xFF);
 }
 
 Window::~Window() {
+  SDL_DestroyTexture(texture);
+  SDL_DestroyRenderer(renderer);
   // Deletes window and surface
   SDL_DestroyWindow(window);
   SDL_Quit();
 }
 
 void Window::drawFrame(const Frame& f) {
-  SDL_LockSurface(screen);
-  SDL_memcpy(screen->pixels, f.pixels.data(),
-             NESWIDTH * NESHEIGHT * sizeof(uint32_t));
-
-  SDL_UnlockSurface(screen);
-
-  SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, screen);
+  TRACE_SCOPE("Present");
+  void* pixels;
+  int pitch;
+  if (SDL_LockTexture(texture, nullptr, &pixels, &pitch) < 0) {
+    error(("Texture could not be locked! SDL_Error: " +
+           std::string(SDL_GetError()))
+              .c_str());
+    return;
+  }
+  palette->convert(f, pixels, pitch);
+  SDL_UnlockTexture(texture);
 
-  int windowWidth, windowHeight;
-  SDL_GetWindowSize(window, &windowWidth, &windowHeight);
+  SDL_Rect dstRect = destination();
 
   SDL_RenderClear(renderer);
-
-  SDL_Rect dstRect = {0, 0, windowWidth, windowHeight};
   SDL_RenderCopy(renderer, texture, nullptr, &dstRect);
   SDL_RenderPresent(renderer);
-  SDL_DestroyTexture(texture);
+}
+
+SDL_Rect Window::destination() const {
+  int outputWidth, outputHeight;
+  SDL_GetRendererOutputSize(renderer, &outputWidth, &outputHeight);
+
+  int width = outputWidth;
+  int height = outputHeight;
+  switch (scaling) {
+    case Scaling::Stretch:
+      break;
+    case Scaling::Aspect: {
+      // 256 pixels at 8:7 are as wide as 2048/7 square pixels
+      constexpr int ASPECT_WIDTH = NESWIDTH * 8;
+      constexpr int ASPECT_HEIGHT = NESHEIGHT * 7;
+      if (outputWidth * ASPECT_HEIGHT > outputHeight * ASPECT_WIDTH) {
+        width = outputHeight * ASPECT_WIDTH / ASPECT_HEIGHT;
+      } else {
+        height = outputWidth * ASPECT_HEIGHT / ASPECT_WIDTH;
+      }
+      break;
+    }
+    case Scaling::Integer: {
+      int scale = std::min(outputWidth / static_cast<int>(NESWIDTH),
+                           outputHeight / static_cast<int>(NESHEIGHT));
+      scale = std::max(1, scale);
+      width = NESWIDTH * scale;
+      height = NESHEIGHT * scale;
+      break;
+    }
+  }
+
+  return {(outputWidth - width) / 2, (outputHeight - height) / 2, width,
+          height};
+}
+
+void Window::run() {
+  TRACE_THREAD("Window");
+  while (isOpen()) {
+    poll();
+    if (frames.update()) {
+      drawFrame(frames.getFront());
+    } else {
+      SDL_Delay(1);
+    }
+  }
 }
 
 void Window::poll() {
   SDL_Event e;
   while (SDL_PollEvent(&e)) {
-    if (e.type == SDL_QUIT) exit(0);
+    switch (e.type) {
+      case SDL_QUIT:
+        open.store(false, std::memory_order_relaxed);
+        break;
+      case SDL_KEYDOWN:
+      case SDL_KEYUP:
+        handleKey(e.key);
+        break;
+    }
+  }
+}
+
+void Window::handleKey(const SDL_KeyboardEvent& key) {
+  uint8_t button;
+  switch (key.keysym.sym) {
+    case SDLK_x:
+      button = BUTTON_A;
+      break;
+    case SDLK_z:
+      button = BUTTON_B;
+      break;
+    case SDLK_RSHIFT:
+      button = BUTTON_SELECT;
+      break;
+    case SDLK_RETURN:
+      button = BUTTON_START;
+      break;
+    case SDLK_UP:
+      button = BUTTON_UP;
+      break;
+    case SDLK_DOWN:
+      button = BUTTON_DOWN;
+      break;
+    case SDLK_LEFT:
+      button = BUTTON_LEFT;
+      break;
+    case SDLK_RIGHT:
+      button = BUTTON_RIGHT;
+      break;
+    default:
+      return;
   }
+
+  uint8_t prev = buttons;
+  if (key.type == SDL_KEYDOWN) {
+    buttons |= button;
+  } else {
+    buttons &= ~button;
+  }
+  if (buttons == prev) return;
+
+  // Takes effect on the frame the emulation thread starts next
+  InputEvent event = {currentFrame.load(std::memory_order_relaxed) + 1, 0,
+                      buttons};
+  if (!inputs.push(event)) warning("Input queue full, dropping input");
+}
+
+void Window::submitFrame(const Frame& f) {
+  frames.getBack() = f;
+  frames.publish();
 }
 
 void Window::displayPatternTable(uint8_t* patternTable) {
   enum PixelFormat { TRANSPARENT = 0, COLOR1 = 1, COLOR2 = 2, COLOR3 = 3 };
 
+  // White, light grey, dark grey and black from the NES palette
+  constexpr uint8_t transparent = 0x30;
+  constexpr uint8_t color1 = 0x10;
+  constexpr uint8_t color2 = 0x00;
+  constexpr uint8_t color3 = 0x0F;
+
   int x = 0;
   int y = 0;
 
-  Frame f(window);
-  memset(f.pixels.data(), 0, f.pixels.size() * sizeof(uint32_t));
+  Frame f;
+  f.pixels.fill(color3);
 
   int num = 0;
   // Pattern Table 1
@@ -103,16 +234,16 @@ void Window::displayPatternTable(uint8_t* patternTable) {
     for (auto pixel : pixels) {
       switch (pixel) {
         case TRANSPARENT:
-          f.setPixel(x, y, 0xFF, 0xFF, 0xFF, 0x00);
+          f.setPixel(x, y, transparent);
           break;
         case COLOR1:
-          f.setPixel(x, y, 0xB6, 0xB6, 0xB6, 0xFF);
+          f.setPixel(x, y, color1);
           break;
         case COLOR2:
-          f.setPixel(x, y, 0x67, 0x67, 0x67, 0xFF);
+          f.setPixel(x, y, color2);
           break;
         case COLOR3:
-          f.setPixel(x, y, 0x00, 0x00, 0x00, 0xFF);
+          f.setPixel(x, y, color3);
           break;
       }
 
@@ -156,16 +287,16 @@ void Window::displayPatternTable(uint8_t* patternTable) {
     for (auto pixel : pixels) {
       switch (pixel) {
         case TRANSPARENT:
-          f.setPixel(x, y, 0xFF, 0xFF, 0xFF, 0x00);
+          f.setPixel(x, y, transparent);
           break;
         case COLOR1:
-          f.setPixel(x, y, 0xB6, 0xB6, 0xB6, 0xFF);
+          f.setPixel(x, y, color1);
           break;
         case COLOR2:
-          f.setPixel(x, y, 0x67, 0x67, 0x67, 0xFF);
+          f.setPixel(x, y, color2);
           break;
         case COLOR3:
-          f.setPixel(x, y, 0x00, 0x00, 0x00, 0xFF);
+          f.setPixel(x, y, color3);
           break;
       }
 
@@ -188,5 +319,5 @@ void Window::displayPatternTable(uint8_t* patternTable) {
     }
   }
 
-  drawFrame(f);
+  submitFrame(f);
 }
@@ -3,49 +3,79 @@
 #include <SDL2/SDL.h>
 
 #include <array>
+#include <atomic>
 #include <cstdint>
+#include <memory>
+#include <string>
 
 #include "SDL_pixels.h"
 #include "SDL_render.h"
 #include "SDL_video.h"
+#include "frame.h"
+#include "input.h"
+#include "palette.h"
+#include "spscQueue.h"
+#include "tripleBuffer.h"
 
-constexpr size_t NESWIDTH = 256;
-constexpr size_t NESHEIGHT = 240;
-
-struct Frame {
- private:
-  SDL_PixelFormat* format;
-
+class Window {
  public:
-  std::array<uint32_t, (NESWIDTH * NESHEIGHT)> pixels;
-
-  Frame(SDL_Window* window)
-      : format(SDL_AllocFormat(SDL_GetWindowPixelFormat(window))) {}
-  ~Frame() { SDL_FreeFormat(format); }
-  inline void setPixel(size_t x, size_t y, uint8_t r, uint8_t g, uint8_t b,
-                       uint8_t a) {
-    pixels[x + (y * NESWIDTH)] = SDL_MapRGBA(format, r, g, b, a);
-  }
-};
+  enum class Scaling {
+    Stretch,  // Fill the window
+    Aspect,   // Largest size with the NES's 8:7 pixel aspect ratio
+    Integer,  // Largest whole multiple of the NES resolution
+  };
 
-class Window {
  private:
   int screenWidth;
   int screenHeight;
 
   SDL_Window* window;
   SDL_Renderer* renderer;
-  SDL_Surface* screen;
+  SDL_Texture* texture;  // Streaming, frames are converted straight into it
+
+  Scaling scaling;
+
+  std::unique_ptr<Palette> palette;
+
+  // Completed frames from the emulation thread
+  TripleBuffer<Frame> frames;
+  std::atomic<uint64_t> currentFrame;  // Used to timestamp inputs
+
+  // Button changes for the emulation thread
+  EventInput inputs;
+  uint8_t buttons;
+
+  std::atomic<bool> open;
 
  public:
-  Window();
+  Window(bool vsync = true, Scaling scaling = Scaling::Aspect);
   ~Window();
 
-  void drawFrame(const Frame& f);
+  inline void setScaling(Scaling val) { scaling = val; }
 
-  void displayPatternTable(uint8_t* patternTable);
+  inline const Palette& getPalette() const { return *palette; }
+  inline bool loadPalette(const std::string& path) {
+    return palette->load(path);
+  }
 
+  // Presentation thread, SDL has to be driven from the thread that created
+  // the window. Returns once the window is closed
+  void run();
   void poll();
 
+  // Emulation thread
+  void submitFrame(const Frame& f);
+  inline void setCurrentFrame(uint64_t frame) {
+    currentFrame.store(frame, std::memory_order_relaxed);
+  }
+  inline InputSource& getInput() { return inputs; }
+  inline bool isOpen() const { return open.load(std::memory_order_relaxed); }
+
+  void displayPatternTable(uint8_t* patternTable);
+
  private:
+  void drawFrame(const Frame& f);
+  void handleKey(const SDL_KeyboardEvent& key);
+
+  SDL_Rect destination() const;
 };